@@ -2,7 +2,11 @@
 #define BASIC_CONFIG_H_
 
 #define TIME_TRAP_INTERVAL 1000000
-#define MAX_CPU_NUM 8
-#define STATIC_PROC_NUM 64
+#define MAX_CPU_NUM 64
+#define CACHE_LINE_SIZE 64
+#define MAX_PROC_NUM 4096
+#define USTACK_MAX_PAGES 16 // user stack of a thread grows up to it
+#define EXEC_IMAGE_NUM 16    // binaries whose read only pages are cached
+#define EXEC_IMAGE_PAGES 128 // pages cached for a binary
 
 #endif
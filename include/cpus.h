@@ -3,9 +3,12 @@
 
 #include "config/basic_config.h"
 #include "config/basic_types.h"
+#include "process/cpu_message.h"
 #include "process/proc_group.h"
 #include "process/process.h"
 #include "riscv/regs.h"
+#include "scheduler/run_queue.h"
+#include "scheduler/sched_policy.h"
 #include "trap/introff.h"
 
 struct cpu {
@@ -14,9 +17,31 @@ struct cpu {
     struct process *my_proc;
     struct context scheduler_context;
 
+    // procs of my group placed on me, see scheduler/run_queue.h. others push
+    // to it, keep it away from fields only I touch
+    struct run_queue rq __attribute__((aligned(CACHE_LINE_SIZE)));
+
+    // set by scheduler before it checks for work and waits for intr. whoever
+    // gives it work after that claims it by clearing idle and kicks it, so an
+    // idle cpu is kicked once however many wakers find it
+    int idle;
+
+    // times I trapped from user mode, read by others, see process/proc_mm.h
+    uint64 user_traps;
+
+    // running a proc of default group for my group, see run_process()
+    int lent;
+    // ticks my_proc can run before it is preempted
+    int slice_left;
+    // switched out directly to my_proc, whose lock is released by my_proc
+    struct process *prev_proc;
+
+    // messages for me, see process/cpu_message.h
+    struct cpu_mailbox mailbox __attribute__((aligned(CACHE_LINE_SIZE)));
+
     uint64 origin_ie;
     int introff_n;
-};
+} __attribute__((aligned(CACHE_LINE_SIZE)));
 
 extern int panicked;
 
@@ -50,6 +75,10 @@ static inline void init_cpus(void)
     for (int i = 0; i < MAX_CPU_NUM; i++) {
         cpus[i].cpu_id = -1;
         cpus[i].pgroup_id = -1;
+        init_run_queue(&cpus[i].rq, -1, SCHED_RR);
+        init_cpu_mailbox(&cpus[i].mailbox);
+        cpus[i].lent = 0;
+        cpus[i].prev_proc = NULL;
     }
 }
 
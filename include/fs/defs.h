@@ -247,6 +247,7 @@ extern uint64 sys_fstat(void);
 extern uint64 sys_link(void);
 extern uint64 sys_mkdir(void);
 extern uint64 sys_mknod(void);
+extern uint64 sys_mmap(void);
 extern uint64 sys_open(void);
 extern uint64 sys_pipe(void);
 extern uint64 sys_read(void);
@@ -270,6 +271,7 @@ GEN_SYSCALL_FN(fstat)
 GEN_SYSCALL_FN(link)
 GEN_SYSCALL_FN(mkdir)
 GEN_SYSCALL_FN(mknod)
+GEN_SYSCALL_FN(mmap)
 GEN_SYSCALL_FN(open)
 GEN_SYSCALL_FN(pipe)
 GEN_SYSCALL_FN(read)
@@ -3,7 +3,7 @@
 
 #include "config/basic_config.h"
 
-#define NPROC STATIC_PROC_NUM     // maximum number of processes
+#define NPROC MAX_PROC_NUM        // maximum number of processes
 #define NCPU MAX_CPU_NUM          // maximum number of CPUs
 #define NOFILE 16                 // open files per process
 #define NFILE 100                 // open files per system
@@ -11,6 +11,7 @@ struct spin_lock {
 };
 
 void acquire_spin_lock(struct spin_lock *lock);
+int try_acquire_spin_lock(struct spin_lock *lock);
 void release_spin_lock(struct spin_lock *lock);
 
 static inline void init_spin_lock(struct spin_lock *lock)
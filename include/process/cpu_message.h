@@ -3,25 +3,51 @@
 
 #include "config/basic_config.h"
 #include "config/basic_types.h"
-#include "lock/spin_lock.h"
 
-enum cpu_message_type { EMP_MESSAGE, NEED_CPU, NEED_CPU_FLEX };
+enum cpu_message_type {
+    EMP_MESSAGE,
+    NEED_CPU,
+    NEED_CPU_FLEX,
+    PGROUP_SHRINK,
+};
 
 struct cpu_message {
     enum cpu_message_type type;
     void *message;
 };
 
+// power of 2, a NEED_CPU* message takes a free cpu, so no more than
+// MAX_CPU_NUM of them are on the way
 #define CPU_MESSAGE_BOX_SIZE MAX_CPU_NUM
 
-void init_cpu_message(void);
+/*
+ * every cpu has a mailbox, a bounded lock free queue, any cpu can send and
+ * only the owner receives. cell.seq tells whose turn the cell is:
+ * seq == pos: free for the sender taking pos.
+ * seq == pos + 1: filled, for the receiver taking pos.
+ *
+ * NEED_CPU* messages are for free cpus(cpus in default group). a cpu out of
+ * default group forwards such messages it got to free cpus. PGROUP_SHRINK
+ * asks the cpu to leave the group in message if it is still there.
+ */
+struct cpu_mailbox {
+    struct {
+        uint64 seq;
+        struct cpu_message m;
+    } cells[CPU_MESSAGE_BOX_SIZE];
+    uint64 send_pos;
+    // only the owner touches it, keep it off senders' line
+    uint64 recv_pos __attribute__((aligned(CACHE_LINE_SIZE)));
+};
+
+void init_cpu_mailbox(struct cpu_mailbox *box);
 
-uint64 no_message_atomic(void);
+int has_cpu_message(int cpu_id);
 
 struct cpu_message get_cpu_message(void);
 
-void resend_cpu_message(struct cpu_message m);
+int send_cpu_message_to(int cpu_id, struct cpu_message m);
 
-void send_cpu_message(struct cpu_message m);
+int send_cpu_message(struct cpu_message m);
 
 #endif
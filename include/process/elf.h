@@ -22,7 +22,7 @@
 // p_flags
 #define PF_X 0x1
 #define PF_W 0x2
-#define PF_R 0x3
+#define PF_R 0x4
 
 /* Type for a 16-bit quantity.  */
 typedef uint16 Elf32_Half;
@@ -0,0 +1,44 @@
+#ifndef EXEC_IMAGE_H_
+#define EXEC_IMAGE_H_
+
+#include "config/basic_config.h"
+#include "config/basic_types.h"
+
+struct inode;
+
+/*
+ * read only pages of a binary, shared by procs exec()ing it. pages[i] is
+ * page i of the file, read n bytes with the rest zeroed, see struct
+ * mm_region. the image holds a reference of its pages, procs mapping them
+ * hold theirs, see vm/kalloc.h.
+ *
+ * an image is found by (dev, inum) while valid. writing the file drops its
+ * pages and makes it invalid, procs running it read pages on their own since.
+ * an image without ref keeps its pages until its slot is taken by another
+ * binary, least recently used first.
+ *
+ * lock acquire sequence:
+ * mm lock -> image lock
+ */
+struct exec_image {
+    uint dev;
+    uint inum;
+    int valid;
+    int ref; // regions referring to it
+    uint64 last_used;
+    struct {
+        void *page;
+        uint n;
+    } pages[EXEC_IMAGE_PAGES];
+};
+
+void exec_image_init(void);
+struct exec_image *get_exec_image(struct inode *ip);
+void dup_exec_image(struct exec_image *image);
+void put_exec_image(struct exec_image *image);
+void *exec_image_page(struct exec_image *image, uint64 pgno, uint n);
+void exec_image_add_page(struct exec_image *image, uint64 pgno, uint n,
+                         void *page);
+void exec_image_invalidate(struct inode *ip);
+
+#endif
@@ -4,10 +4,28 @@
 #include "config/basic_config.h"
 #include "lock/spin_lock.h"
 #include "process/process.h"
+#include "scheduler/run_queue.h"
+#include "util/cpumask.h"
 #include "util/list.h"
 
 #define MAX_PROC_GROUP_NUM MAX_CPU_NUM
 #define DEFAULT_PGROUP_ID 0
+// mtime a barrier waiter spins before sleeping, see pgroup_barrier_wait()
+#define PGROUP_BARRIER_SPIN (TIME_TRAP_INTERVAL / 20)
+
+/*
+ * n procs of a group wait for each other, phase is bumped when the last one
+ * arrives, and it wakes all sleeping ones. waiters sleep on &phase.
+ *
+ * lock acquire sequence:
+ * barrier lock -> wait bucket lock
+ */
+struct pgroup_barrier {
+    int n; // 0 if not inited
+    int count; // procs arrived in this phase
+    uint64 phase; // read without lock by spinning waiters
+    struct spin_lock lock;
+};
 
 /* invariants:
  * id == -1: empty group, all members inited.
@@ -20,19 +38,38 @@
  *
  * in every time we can only acess my own proc and cpu's proc id.
  *
+ * RUNABLE procs in procs_head are in rq or in run queue of a cpu in the group,
+ * cpus in the group run their own run queue, then rq, then steal from others.
+ *
  * lock acquire sequence:
- * group lock -> a proc lock in group
+ * group lock -> a proc lock in group -> run queue lock
  */
 struct proc_group {
     int id;
     struct list_head procs_head;
-    int cpus[MAX_CPU_NUM];
+    cpumask_t cpus; // written with lock, read by scheduler without lock
     int exclusively_occupy;
+    int policy;     // see scheduler/sched_policy.h
+    int time_slice; // ticks, see scheduler/sched_policy.h
+
+    // has its own lock
+    struct run_queue rq;
+    // vruntime of SCHED_FAIR procs runs from, only grows. atomic
+    uint64 min_vruntime;
+
+    // cpus follow the load, see set_pgroup_autoscale()
+    int autoscale_min;
+    int autoscale_max;
+    int autoscale_target; // load percent per cpu, 0 for off
+    int load_avg;         // runing and RUNABLE procs in percent, smoothed
+
+    // has its own lock, see pgroup_barrier_wait()
+    struct pgroup_barrier barrier;
 
     /* protect all above and process.pgroup_head, and all the process.pgroup_id
      * and cpu.pgroup_id */
     struct spin_lock lock;
-};
+} __attribute__((aligned(CACHE_LINE_SIZE)));
 
 struct need_cpu_message {
     void *sleep_chain;
@@ -56,9 +93,11 @@ int get_pgroup_id(void);
 int pgroup_procs_count(void);
 int create_pgroup(void);
 int enter_pgroup(int pgroup_id);
+int get_pgroup_policy(void);
+int set_pgroup_policy(int policy);
+int set_pgroup_time_slice(int ticks);
 // for process manager to use
 int cpu_leave_pgroup_if_empty(void);
-void proc_move_to_tail(struct proc_group *pgroup, struct process *proc);
 int forkproc_into_pgroup(int pgroup_id, struct process *proc);
 void exit_pgroup(void);
 
@@ -67,8 +106,10 @@ int pgroup_cpu_count(void);
 int inc_pgroup_cpus(void);
 int inc_pgroup_cpus_flex(void);
 int dec_pgroup_cpus(void);
+int set_pgroup_autoscale(int min_cpus, int max_cpus, int target_load);
 // for scheduler to use
 void handle_cpu_acquire(void);
+void pgroup_autoscale_tick(uint64 now);
 
 // procrss group syscall to make proc occupy
 int proc_occupy_cpu(void);
@@ -76,4 +117,8 @@ int proc_release_cpu(void);
 // for others to know currnet condition
 int is_exclusive_occupy(struct process *proc);
 
+// barrier syscall for procs in group
+int pgroup_barrier_init(int n);
+int pgroup_barrier_wait(void);
+
 #endif
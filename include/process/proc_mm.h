@@ -0,0 +1,99 @@
+#ifndef PROC_MM_H_
+#define PROC_MM_H_
+
+#include "config/basic_types.h"
+#include "lock/spin_lock.h"
+#include "util/cpumask.h"
+#include "util/list.h"
+#include "vm/vm.h"
+
+struct exec_image;
+struct inode;
+struct shm_segment;
+
+/*
+ * a range of user memory whose pages are read from ip on first touch, page
+ * at start + i is file_off + i of the file, bytes beyond file_size are zero.
+ * ip, image and shm are referenced by the region. if image is not NULL, pages
+ * are read only and shared through it, see process/exec_image.h. ip is NULL
+ * for zeroed memory, or pages of shm from file_off, see syscall/shm.h.
+ */
+struct mm_region {
+    uint64 start;
+    uint64 end;
+    uint64 attribute;
+    struct inode *ip;
+    struct exec_image *image;
+    struct shm_segment *shm;
+    uint64 file_off;
+    uint64 file_size;
+    struct list_head list;
+};
+
+/*
+ * user memory of a proc, shared by threads created by clone(). every thread
+ * has a slot in it for its user stack and trap frame, see vm/memory_layout.h.
+ *
+ * cpus running in user mode with pgtable are in active_cpus, their TLB may
+ * hold its entries. a cpu leaves active_cpus when it traps into kernel, which
+ * flushes TLB, so a page unmapped is freed only after all cpus active at that
+ * time trap once, see mm_unmap_pages().
+ *
+ * after fork, writable pages are shared by parent and child read only with
+ * PTE_COW, each page counts its references(see vm/kalloc.h). the first store
+ * to it traps into mm_handle_fault(), which gives the storer its own copy, or
+ * the page itself if nobody else refers to it.
+ *
+ * the image of exec()ed file is not read in advance, it is a list of sorted
+ * regions. reading a page sleeps, so mm lock is released meanwhile, and
+ * regions_gen tells if the regions have changed since. regions mapped by
+ * mmap() are above heap, placed downward from PROC_VA_END, and heap never
+ * grows into them.
+ *
+ * lock acquire sequence:
+ * proc lock -> mm lock
+ */
+struct proc_mm {
+    page_table pgtable;
+    uint64 mem_start;
+    uint64 mem_brk;
+    uint64 mem_end;
+    uint64 thread_slots; // bit i set if slot i is used
+    struct list_head regions;
+    uint64 regions_gen;
+    int ref;
+    // protect all above and user memory mapping in pgtable
+    struct spin_lock lock;
+
+    cpumask_t active_cpus; // atomic
+};
+
+enum { FAULT_READ, FAULT_WRITE, FAULT_EXEC };
+
+void proc_mm_init(void);
+struct proc_mm *alloc_mm(void);
+void get_mm(struct proc_mm *mm);
+void put_mm(struct proc_mm *mm);
+int mm_map_thread_slot(struct proc_mm *mm, int slot, void *ustack,
+                       void *trap_frame);
+void mm_unmap_thread_slot(struct proc_mm *mm, int slot);
+void mm_unmap_pages(struct proc_mm *mm, uint64 va, int n);
+void mm_activate(struct proc_mm *mm);
+void mm_deactivate(struct proc_mm *mm);
+void mm_flush_tlb(struct proc_mm *mm);
+int insert_region(struct list_head *regions, const struct mm_region *new);
+int dup_regions(struct list_head *dst, struct list_head *src);
+void free_regions(struct list_head *regions);
+void mm_set_regions(struct proc_mm *mm, struct list_head *regions);
+void free_region_pages(page_table pgtable, struct list_head *regions);
+int mm_share_regions(page_table dst, struct proc_mm *mm);
+int mm_regions_overlap(struct proc_mm *mm, uint64 start, uint64 end);
+uint64 mm_map_region(struct proc_mm *mm, uint64 size, struct mm_region *new);
+struct mm_region *mm_find_region(struct proc_mm *mm, uint64 va);
+int mm_unmap_range(struct proc_mm *mm, uint64 start, uint64 end,
+                   struct list_head *freed);
+int mm_handle_fault(struct proc_mm *mm, uint64 va, int access, int can_sleep);
+int mm_fault_in(page_table pgtable, uint64 va, int access);
+void mm_prefault(uint64 va, uint64 n, int access);
+
+#endif
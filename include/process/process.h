@@ -6,8 +6,11 @@
 #include "fs/fs.h"
 #include "fs/param.h"
 #include "lock/spin_lock.h"
+#include "process/proc_mm.h"
+#include "util/cpumask.h"
 #include "util/list.h"
 #include "util/list_include.h"
+#include "util/skew_heap.h"
 #include "vm/vm.h"
 
 // (MAXPATH + ARGVN*ARGV_STR_LEN + sizeof(char*)*ARGVN) shall be smaller than
@@ -80,6 +83,15 @@ struct trap_frame {
 
 enum { UNUSED, USED, RUNABLE, RUNNING, SLEEP, ZOMBIE };
 
+// opened files and cwd, shared by threads created by clone()
+struct proc_files {
+    struct file *ofile[NOFILE];
+    struct inode *cwd;
+    int ref;
+    // protect all above, ofile[] and cwd are read by their threads without it
+    struct spin_lock lock;
+};
+
 struct process {
     struct spin_lock lock;
     pid_t pid;
@@ -88,15 +100,22 @@ struct process {
     int xstatus;
     void *chain;
     struct process *parent;
+    // children not exited and ZOMBIE children, linked by their sibling, which
+    // is protected by parent's lock. parent is changed with both locks
+    struct list_head children;
+    struct list_head zombies;
+    struct list_head sibling;
+    // in wait bucket of chain when sleeping, protected by the bucket lock. chain
+    // is modified with both locks, see scheduler/sleep.h
+    struct list_head wait_list;
 
     // private, don't need lock
+    struct proc_mm *mm;
+    struct proc_files *files;
+    int thread_slot; // slot in mm for ustack and proc_trap_frame
     uint64 ustack;
-    uint64 mem_start;
-    uint64 mem_brk;
-    uint64 mem_end;
-    page_table proc_pgtable;
-    struct file *ofile[NOFILE];
-    struct inode *cwd;
+    page_table proc_pgtable; // mm->pgtable, changed only by exec()
+    int in_fs_op; // holds inode lock or log op, see mm_fault_in()
 
     uint64 kstack;
     struct trap_frame *proc_trap_frame;
@@ -107,19 +126,34 @@ struct process {
      * can access it, so we can read it without lock, but modify it with lock */
     int pgroup_id;
     struct list_head pgroup_list;
-};
+
+    // protected by lock of the run queue it is in, see scheduler/run_queue.h
+    struct list_head run_list;
+    struct skew_node fair_node;
+    int on_rq;
+    // cpu that ran the proc last time, -1 if never run. protected by proc lock
+    int last_cpu;
+    // cpus proc can run on, see scheduler/sched_policy.h. protected by proc
+    // lock
+    cpumask_t cpu_mask;
+
+    // for SCHED_FAIR, see scheduler/sched_policy.h. protected by proc lock
+    int nice;
+    uint64 vruntime;
+    uint64 exec_start; // mtime when proc starts running
+} __attribute__((aligned(CACHE_LINE_SIZE)));
 
 void process_init(void);
 void setup_init_proc(void);
 uint64 fork(struct process *proc);
+uint64 clone(struct process *proc, uint64 fn, uint64 arg, uint64 ret);
 uint64 exec(struct process *proc, char *file, int argc, char *argv[],
             char str_in_argv[]);
 __attribute__((noreturn)) uint64 exit(struct process *proc, uint64 xstatus);
 uint64 wait(struct process *proc, uint64 int_uva);
 uint64 kill(pid_t pid);
+struct process *get_proc_with_lock(pid_t pid);
 uint64 proc_sys_sleep(int sleep_ticks);
 uint64 count_proc_num(void);
 
-extern struct process proc_set[STATIC_PROC_NUM];
-
 #endif
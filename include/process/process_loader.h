@@ -3,12 +3,14 @@
 
 #include "fs/file.h"
 #include "process/elf.h"
+#include "util/list.h"
 #include "vm/vm.h"
 
 typedef int (*elf_read_fn_t)(struct inode *ip, int user_dst, uint64 dst,
                              uint off, uint n);
 
-uint64 load_process_elf(page_table pgtable, void *elf_file,
-                        Elf64_Word file_size, elf_read_fn_t elf_read);
+uint64 load_process_elf(page_table pgtable, struct list_head *regions,
+                        void *elf_file, Elf64_Word file_size,
+                        elf_read_fn_t elf_read);
 
 #endif
@@ -5,5 +5,8 @@
 #define SCAUSE_SSI (SCAUSE_INTERRPUT_MASK | 1)
 #define SCAUSE_SEI (SCAUSE_INTERRPUT_MASK | 9)
 #define SCAUSE_ECALL_FROM_U 8
+#define SCAUSE_INST_PAGE_FAULT 12
+#define SCAUSE_LOAD_PAGE_FAULT 13
+#define SCAUSE_STORE_PAGE_FAULT 15
 
 #endif
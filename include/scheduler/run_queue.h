@@ -0,0 +1,59 @@
+#ifndef RUN_QUEUE_H_
+#define RUN_QUEUE_H_
+
+#include "lock/spin_lock.h"
+#include "util/list.h"
+#include "util/skew_heap.h"
+
+struct process;
+
+/*
+ * queue of RUNABLE processes. with SCHED_RR it is a fifo linked by
+ * process.run_list, with SCHED_FAIR it is a min heap of process.fair_node
+ * keyed by vruntime, procs of equal vruntime are poped in the order they are
+ * pushed. see scheduler/sched_policy.h. pop takes the heap first, procs pushed
+ * before the policy changes are still poped.
+ *
+ * pinned is a fifo of procs that can only run on some cpus, see
+ * process.cpu_mask. they are pushed to run queue of a cpu they can run on,
+ * and never stolen by other cpus.
+ *
+ * every proc group has a shared run queue, and every cpu has a local run
+ * queue for procs of the group it belongs to. a RUNABLE proc is in exactly one
+ * of its group's run queues. it is pushed by whoever makes it RUNABLE(with proc
+ * lock), and poped by the scheduler which will run it.
+ *
+ * pgroup_id is the group whose procs can be pushed, -1 if the run queue is
+ * closed. a cpu closes its run queue when it leaves a group, and hands the
+ * procs left in it to the group's shared run queue.
+ *
+ * lock acquire sequence:
+ * proc lock -> run queue lock
+ * we never hold two run queue locks.
+ */
+struct run_queue {
+    struct list_head head;
+    struct skew_node *fair;
+    struct list_head pinned;
+    int nr; // procs in queue
+    uint64 fair_seq; // seq of the next proc pushed to fair
+    int pgroup_id;
+    int policy;
+    // protect all above and process.run_list, process.fair_node in it
+    struct spin_lock lock;
+};
+
+void init_run_queue(struct run_queue *rq, int pgroup_id, int policy);
+int run_queue_empty(struct run_queue *rq);
+int run_queue_len(struct run_queue *rq);
+int run_queue_can_steal(struct run_queue *rq);
+int run_queue_push(struct run_queue *rq, struct process *proc);
+int run_queue_push_pinned(struct run_queue *rq, struct process *proc);
+struct process *run_queue_pop(struct run_queue *rq, int pgroup_id);
+struct process *run_queue_steal(struct run_queue *rq, int pgroup_id);
+void run_queue_open(struct run_queue *rq, int pgroup_id, int policy);
+void run_queue_set_policy(struct run_queue *rq, int policy);
+void run_queue_close(struct run_queue *rq, struct run_queue *left);
+void run_queue_splice(struct run_queue *rq, struct run_queue *procs);
+
+#endif
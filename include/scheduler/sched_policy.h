@@ -0,0 +1,27 @@
+#ifndef SCHED_POLICY_H_
+#define SCHED_POLICY_H_
+
+/*
+ * scheduling policy of a proc group, shared with user space.
+ *
+ * SCHED_RR: procs run in the order they become RUNABLE.
+ * SCHED_FAIR: procs with the smallest vruntime run first. vruntime grows with
+ * run time, slower for procs with lower nice, so cpu time is shared by weight.
+ */
+#define SCHED_RR 0
+#define SCHED_FAIR 1
+
+#define NICE_MIN (-20)
+#define NICE_MAX 19
+#define NICE_DEFAULT 0
+
+// ticks a proc runs before it is preempted, set for each proc group
+#define TIME_SLICE_MIN 1
+#define TIME_SLICE_MAX 100
+#define TIME_SLICE_DEFAULT 1
+
+// bit i set if a proc can run on cpu i, only cpus of its group count. a proc
+// can run on any cpu of its group if none of them is in its mask
+#define CPU_MASK_ALL (~0UL)
+
+#endif
@@ -1,6 +1,21 @@
 #ifndef SCHEDULER_H_
 #define SCHEDULER_H_
 
+#include "process/proc_group.h"
+#include "process/process.h"
+#include "util/cpumask.h"
+
+struct cpu;
+
 void scheduler(void);
+void set_proc_runable(struct process *proc);
+int claim_idle_cpu(struct cpu *c);
+struct cpu *claim_idle_cpu_in_pgroup(struct proc_group *pgroup, int prefer,
+                                     cpumask_t mask);
+int kick_idle_cpus(struct proc_group *pgroup, int all);
+int set_my_nice(int nice);
+int set_proc_affinity(int pid, cpumask_t mask);
+int switch_to_next_proc(struct process *prev);
+void finish_proc_switch(void);
 
 #endif
@@ -2,7 +2,24 @@
 #define SLEEP_H_
 
 #include "lock/spin_lock.h"
+#include "util/list.h"
 
+/*
+ * sleeping procs are hashed by their chain into wait buckets, wake_up(chain)
+ * only looks at procs in chain's bucket. a proc sleeping on NULL chain is in no
+ * bucket, it can only be waked by someone who knows it(see wait()).
+ *
+ * lock acquire sequence:
+ * lock passed to sleep -> wait bucket lock -> proc lock -> run queue lock
+ */
+#define WAIT_BUCKET_NUM 64
+
+struct wait_bucket {
+    struct list_head head; // sleeping procs, linked by process.wait_list
+    struct spin_lock lock;
+};
+
+void sleep_init(void);
 void sleep(struct spin_lock *lock, void *chain);
 void wake_up(void *chain);
 
@@ -0,0 +1,43 @@
+#ifndef TIMER_H_
+#define TIMER_H_
+
+#include "config/basic_types.h"
+#include "util/list.h"
+
+/*
+ * hierarchical timer wheel, driven by ticks.
+ *
+ * level n has TIMER_WHEEL_SIZE slots, a slot covers TIMER_WHEEL_SIZE^n ticks.
+ * a timer is hashed into the lowest level that covers its expire tick, timers
+ * in a higher level slot are moved down when the wheel turns to the slot. so a
+ * tick only touches timers that expire at the tick, and the timers cascaded.
+ *
+ * fn is called once at expire tick with timer lock held and intr off, it can't
+ * sleep or add/del timers. it can wake_up() procs, which is how sleepers use it.
+ *
+ * lock acquire sequence:
+ * timer lock -> locks acquired in fn(wait bucket lock, proc lock...)
+ */
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SIZE (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SIZE - 1)
+#define TIMER_WHEEL_LEVEL 3
+
+#define TIMER_NO_EXPIRES ((uint64)-1)
+
+struct timer {
+    struct list_head list; // empty when timer is not pending
+    uint64 expires;
+    void (*fn)(void *arg);
+    void *arg;
+};
+
+void timer_init(void);
+void init_timer(struct timer *t, void (*fn)(void *), void *arg);
+void add_timer(struct timer *t, uint64 expires);
+int del_timer(struct timer *t);
+void run_timers(uint64 now);
+uint64 next_timer_expires(void);
+int timer_sleep(uint64 ticks);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef FUTEX_H_
+#define FUTEX_H_
+
+#include "config/basic_types.h"
+#include "lock/spin_lock.h"
+#include "process/process.h"
+#include "util/list.h"
+
+/*
+ * futex lets user procs sleep on a word of their memory. a word of shm is
+ * keyed by its physical address, so procs attaching the segment meet in the
+ * same futex wherever they map it. other words are private to the mm and
+ * keyed by (mm, uva), which stays the same when fork moves the page copy on
+ * write.
+ *
+ * waiters are queued in the futex bucket hashed by the key and sleep with
+ * their proc as chain, see scheduler/sleep.h, so kill() wakes them too.
+ * futex_wait() checks the word and queues under the bucket lock,
+ * futex_wake() dequeues under it, so a wake after the word changes is never
+ * lost.
+ *
+ * lock acquire sequence:
+ * futex bucket lock -> mm lock
+ * futex bucket lock -> wait bucket lock
+ */
+#define FUTEX_BUCKET_NUM 64
+
+struct futex_key {
+    struct proc_mm *mm; // NULL if addr is physical
+    uint64 addr;
+};
+
+struct futex_bucket {
+    struct list_head head; // waiters, linked by futex_waiter.list
+    struct spin_lock lock;
+};
+
+void futex_init(void);
+uint64 futex_wait(struct process *proc, uint64 uva, uint32 expected);
+uint64 futex_wake(struct process *proc, uint64 uva, int n);
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef MMAN_H_
+#define MMAN_H_
+
+// prot of mmap()
+#define PROT_READ 0x1
+#define PROT_WRITE 0x2
+#define PROT_EXEC 0x4
+
+// flags of mmap()
+#define MAP_SHARED 0x01
+#define MAP_PRIVATE 0x02
+#define MAP_ANONYMOUS 0x20
+
+#define MAP_FAILED ((void *)-1)
+
+// flags of shm_create()
+#define SHM_PGROUP 0x1
+
+#endif
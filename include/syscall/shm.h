@@ -0,0 +1,46 @@
+#ifndef SHM_H_
+#define SHM_H_
+
+#include "config/basic_types.h"
+#include "process/process.h"
+#include "riscv/vm_system.h"
+
+/*
+ * shared memory segment, attached by procs at their own addresses as a
+ * region, see process/proc_mm.h. the same pages are mapped in all of them,
+ * they stay shared after fork(), and futex works across procs on them.
+ *
+ * pages are allocated zeroed on first touch, page i is dirs[i / SHM_DIR_LEN]
+ * [i % SHM_DIR_LEN], and the segment holds a reference of them.
+ *
+ * a segment is found by id until it is destroyed, and is freed when no region
+ * refers to it since. if pgroup_id is not -1, only procs of that group can
+ * attach or destroy it.
+ *
+ * lock acquire sequence:
+ * mm lock -> shm lock
+ */
+#define SHM_NUM 64
+#define SHM_DIRS 16
+#define SHM_DIR_LEN (PGSIZE / sizeof(void *))
+#define SHM_MAX_PAGES (SHM_DIRS * SHM_DIR_LEN)
+
+struct shm_segment {
+    int used;
+    int destroyed;
+    int ref; // regions referring to it
+    int pgroup_id;
+    uint64 npages;
+    void **dirs[SHM_DIRS];
+};
+
+void shm_init(void);
+void dup_shm(struct shm_segment *shm);
+void put_shm(struct shm_segment *shm);
+void *shm_page(struct shm_segment *shm, uint64 pgno);
+uint64 shm_create(struct process *proc, uint64 size, int flags);
+uint64 shm_attach(struct process *proc, int id);
+uint64 shm_detach(struct process *proc, uint64 addr);
+uint64 shm_destroy(struct process *proc, int id);
+
+#endif
@@ -26,8 +26,17 @@
 #define SYSCALL_MKNOD 20
 #define SYSCALL_CHDIR 21
 #define SYSCALL_PIPE 22
+#define SYSCALL_CLONE 23
+#define SYSCALL_FUTEX_WAIT 24
+#define SYSCALL_FUTEX_WAKE 25
+#define SYSCALL_MMAP 26
+#define SYSCALL_MUNMAP 27
+#define SYSCALL_SHM_CREATE 28
+#define SYSCALL_SHM_ATTACH 29
+#define SYSCALL_SHM_DETACH 30
+#define SYSCALL_SHM_DESTROY 31
 
-#define SYSCALL_MAX_ID 22
+#define SYSCALL_MAX_ID 31
 #define SYSCALL_NUM (SYSCALL_MAX_ID + 1)
 
 #define SYSCALL_PG_START_ID 100
@@ -41,8 +50,16 @@
 #define SYSCALL_PROC_OCCUPY_CPU (SYSCALL_PG_START_ID + 7)
 #define SYSCALL_PROC_RELEASE_CPU (SYSCALL_PG_START_ID + 8)
 #define SYSCALL_INC_PG_CPUS_FLEX (SYSCALL_PG_START_ID + 9)
+#define SYSCALL_SET_PG_POLICY (SYSCALL_PG_START_ID + 10)
+#define SYSCALL_SET_NICE (SYSCALL_PG_START_ID + 11)
+#define SYSCALL_SET_PG_AUTOSCALE (SYSCALL_PG_START_ID + 12)
+#define SYSCALL_SET_PG_TIME_SLICE (SYSCALL_PG_START_ID + 13)
+#define SYSCALL_SET_AFFINITY (SYSCALL_PG_START_ID + 14)
+#define SYSCALL_PG_BARRIER_INIT (SYSCALL_PG_START_ID + 15)
+#define SYSCALL_PG_BARRIER_WAIT (SYSCALL_PG_START_ID + 16)
+#define SYSCALL_GET_PG_POLICY (SYSCALL_PG_START_ID + 17)
 
-#define SYSCALL_PG_MAX_ID (SYSCALL_PG_START_ID + 9)
+#define SYSCALL_PG_MAX_ID (SYSCALL_PG_START_ID + 17)
 #define SYSCALL_PG_NUM (SYSCALL_PG_MAX_ID - SYSCALL_PG_START_ID + 1)
 
 #define SYSCALL_DB_START_ID 1000
@@ -4,7 +4,12 @@
 #include "config/basic_types.h"
 #include "process/process.h"
 
+struct inode;
+
 uint64 brk(struct process *proc, uint64 new_brk);
 uint64 sbrk(struct process *proc, int64 increment);
+uint64 mmap(struct process *proc, uint64 length, int prot, int flags,
+            struct inode *ip, uint64 off);
+uint64 munmap(struct process *proc, uint64 addr, uint64 length);
 
 #endif
@@ -3,12 +3,10 @@
 
 #include "config/basic_types.h"
 
-extern struct spin_lock tick_lock;
-extern uint64 tick_count;
-
-void intr_init(void);
-
 uint64 get_ticks(void);
+void tick_periodic(void);
+void tick_oneshot(uint64 deadline);
+void kick_cpu(int id);
 
 void switch_to_scheduler(void);
 
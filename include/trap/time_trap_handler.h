@@ -1,6 +1,27 @@
 #ifndef TIME_TRAP_HANDLER_H_
 #define TIME_TRAP_HANDLER_H_
 
+#include "config/basic_config.h"
+#include "config/basic_types.h"
+
+/*
+ * information for time_trap_vec to use, one line for a hart:
+ * [0] = mtimecmp
+ * [1] = mtime
+ * [2] = interval of the time trap, 0 for one shot time trap
+ * [3..5] = save registers in time_trap_handler
+ * [6] = set to 1 by time trap, cleared by s-mode when handle the tick
+ * [7] = msip, other harts write it to kick this hart
+ */
+#define MTIME_SETTING_MTIMECMP 0
+#define MTIME_SETTING_MTIME 1
+#define MTIME_SETTING_INTERVAL 2
+#define MTIME_SETTING_TICK 6
+#define MTIME_SETTING_MSIP 7
+#define MTIME_SETTING_SIZE 8
+
+extern uint64 mtime_setting[MAX_CPU_NUM][MTIME_SETTING_SIZE];
+
 extern void time_trap_vec(void);
 
 #endif
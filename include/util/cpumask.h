@@ -0,0 +1,55 @@
+#ifndef CPUMASK_H_
+#define CPUMASK_H_
+
+#include "config/basic_config.h"
+#include "config/basic_types.h"
+#include "util/list_include.h"
+
+/*
+ * set of cpus, bit i for cpu i. a mask is a single word, so it is read without
+ * lock by READ_ONCE(), and changed by whoever owns it with WRITE_ONCE(), see
+ * the struct holding it.
+ */
+typedef uint64 cpumask_t;
+
+#if MAX_CPU_NUM > 64
+#error "cpumask_t holds at most 64 cpus"
+#endif
+
+#if MAX_CPU_NUM == 64
+#define CPUMASK_POSSIBLE (~0UL)
+#else
+#define CPUMASK_POSSIBLE ((1UL << MAX_CPU_NUM) - 1)
+#endif
+
+static inline cpumask_t cpumask_of(int cpu) { return 1UL << cpu; }
+
+static inline int cpumask_test(cpumask_t mask, int cpu)
+{
+    return (mask >> cpu) & 1;
+}
+
+static inline int cpumask_weight(cpumask_t mask)
+{
+    return __builtin_popcountl(mask);
+}
+
+// first cpu in mask, -1 if mask is empty
+static inline int cpumask_first(cpumask_t mask)
+{
+    return mask == 0 ? -1 : __builtin_ctzl(mask);
+}
+
+// first cpu in mask after cpu, wrap around to the start, -1 if mask is empty
+static inline int cpumask_next_wrap(cpumask_t mask, int cpu)
+{
+    cpumask_t after = cpu + 1 >= 64 ? 0 : mask & (~0UL << (cpu + 1));
+    return cpumask_first(after != 0 ? after : mask);
+}
+
+// iterate cpus in mask, mask is read once
+#define for_each_cpu(cpu, mask)                                                \
+    for (cpumask_t __m = (mask);                                               \
+         __m != 0 && ((cpu) = __builtin_ctzl(__m), 1); __m &= __m - 1)
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef SKEW_HEAP_H_
+#define SKEW_HEAP_H_
+
+#include "config/basic_types.h"
+#include "util/list_include.h"
+
+/*
+ * intrusive min heap keyed by uint64, embed skew_node in the element.
+ *
+ * merge, push and pop are amortized O(log n). merge works top down without
+ * recursion, so it is safe on kernel stack. of equal keys, the one with smaller
+ * seq is poped first, set seq from a counter before push to make ties fifo.
+ */
+struct skew_node {
+    struct skew_node *left;
+    struct skew_node *right;
+    uint64 key;
+    uint64 seq;
+};
+
+#define skew_heap_entry(ptr, type, member) container_of(ptr, type, member)
+
+static inline int skew_node_less(struct skew_node *a, struct skew_node *b)
+{
+    return a->key < b->key || (a->key == b->key && a->seq < b->seq);
+}
+
+static inline struct skew_node *skew_heap_merge(struct skew_node *a,
+                                                struct skew_node *b)
+{
+    struct skew_node *root = NULL;
+    struct skew_node **pos = &root;
+    while (a != NULL && b != NULL) {
+        if (skew_node_less(b, a)) {
+            struct skew_node *t = a;
+            a = b;
+            b = t;
+        }
+        // a is the smaller root, merge b into its right subtree, then swap
+        // its children
+        *pos = a;
+        struct skew_node *right = a->right;
+        a->right = a->left;
+        pos = &a->left;
+        a = right;
+    }
+    *pos = a != NULL ? a : b;
+    return root;
+}
+
+static inline void skew_heap_push(struct skew_node **root,
+                                  struct skew_node *node)
+{
+    node->left = NULL;
+    node->right = NULL;
+    *root = skew_heap_merge(*root, node);
+}
+
+// return NULL if heap is empty
+static inline struct skew_node *skew_heap_pop(struct skew_node **root)
+{
+    struct skew_node *node = *root;
+    if (node != NULL) {
+        *root = skew_heap_merge(node->left, node->right);
+        node->left = NULL;
+        node->right = NULL;
+    }
+    return node;
+}
+
+#endif
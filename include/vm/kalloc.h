@@ -14,5 +14,7 @@ struct mem_list {
 void kalloc_init();
 void *kalloc();
 void kfree(void *);
+void kdup(void *);
+int kref_count(void *);
 
 #endif
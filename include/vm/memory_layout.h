@@ -1,6 +1,7 @@
 #ifndef MEMORY_LAYOUT_H_
 #define MEMORY_LAYOUT_H_
 
+#include "config/basic_config.h"
 #include "driver/uart.h"
 #include "riscv/clint.h"
 #include "riscv/plic.h"
@@ -31,15 +32,29 @@
  * user memory layout
  * 0x1000                   PROC_VA_START
  *                          <elf things>
- * VA_END - PGSIZE*4        PROTECT_PAGE
- * VA_END - PGSIZE*3        USTACK_BASE
- * VA_END - PGSIZE*2        TRAP_FRAME_BASE
+ *                          PROC_VA_END
+ *                          <thread slot MAX_THREAD_NUM - 1>
+ *                          ...
+ *                          <thread slot 0>
  * VA_END - PGSIZE          TRAMPOLINE_BASE
+ *
+ * every thread sharing the memory has a slot, see process/proc_mm.h:
+ * THREAD_SLOT_BASE(i)      PROTECT_PAGE
+ * USTACK_LIMIT(i)          user stack grows down to here on demand
+ * USTACK_VA(i)             user stack, first page
+ * TRAPFRAME_VA(i)          trap frame
  */
+#define MAX_THREAD_NUM 16
+#define THREAD_SLOT_SIZE (PGSIZE * (USTACK_MAX_PAGES + 2))
+#define THREAD_SLOT_BASE(I) (TRAMPOLINE_BASE - THREAD_SLOT_SIZE * ((I) + 1))
+#define USTACK_LIMIT(I) (THREAD_SLOT_BASE(I) + PGSIZE)
+#define TRAPFRAME_VA(I) (THREAD_SLOT_BASE(I) + THREAD_SLOT_SIZE - PGSIZE)
+#define USTACK_VA(I) (TRAPFRAME_VA(I) - PGSIZE)
+
 #define PROC_VA_START 0x1000
-#define PROC_VA_END (VA_END - PGSIZE * 4)
-#define USTACK_BASE (VA_END - PGSIZE * 3)
-#define TRAPFRAME_BASE (VA_END - PGSIZE * 2)
+#define PROC_VA_END THREAD_SLOT_BASE(MAX_THREAD_NUM - 1)
+#define USTACK_BASE USTACK_VA(0)
+#define TRAPFRAME_BASE TRAPFRAME_VA(0)
 //      TRAMPOLINE_BASE
 
 #define MAX_PA (MEMORY_END - 1)
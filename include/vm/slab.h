@@ -0,0 +1,27 @@
+#ifndef SLAB_H_
+#define SLAB_H_
+
+#include "config/basic_types.h"
+#include "lock/spin_lock.h"
+
+/*
+ * cache of objects of a size, carved from pages of kalloc(). pages are never
+ * given back, so an object stays an object of the type after it is freed, and
+ * it's ok to lock a freed one, check it and give up. free objects are linked by
+ * the pointer at link_offset, the rest of them is untouched. ctor is called
+ * once for each object, when its page is carved.
+ */
+struct slab_cache {
+    uint64 obj_size; // rounded up to CACHE_LINE_SIZE
+    uint64 link_offset;
+    void (*ctor)(void *obj);
+    void *free_head;
+    struct spin_lock lock;
+};
+
+void init_slab_cache(struct slab_cache *cache, uint64 obj_size,
+                     uint64 link_offset, void (*ctor)(void *obj));
+void *slab_alloc(struct slab_cache *cache);
+void slab_free(struct slab_cache *cache, void *obj);
+
+#endif
@@ -8,6 +8,9 @@
 #define ROUND_UP_PGSIZE(ADDR) ((((uint64)(ADDR)) + PGSIZE - 1) & (~PGSIZE_MASK))
 #define ROUND_DOWN_PGSIZE(ADDR) (((uint64)(ADDR)) & (~PGSIZE_MASK))
 
+// user page shared read only, copied on the first store, see process/proc_mm.h
+#define PTE_COW PTE_RSW_1
+
 enum { KPTR, UPTR };
 
 typedef uint64 pte;
@@ -28,9 +31,13 @@ void unmap_page_free(page_table pgtable, uint64 va);
 void unmap_n_pages(page_table pgtable, uint64 va, int n);
 void unmap_n_pages_free(page_table pgtable, uint64 va, int n);
 void unmap_n_pages_free_hole(page_table pgtable, uint64 va, int n);
+void unmap_n_pages_keep(page_table pgtable, uint64 va, int n);
+void free_kept_pages(page_table pgtable, uint64 va, int n);
 page_table copy_page_table(page_table pgtable);
 int merge_page_table_in_interval(page_table mapped_table, page_table pgtable,
                                  uint64 start, uint64 end);
+int share_page_table_in_interval(page_table mapped_table, page_table pgtable,
+                                 uint64 start, uint64 end);
 void free_page_table(page_table pgtable);
 
 // copy between kernel and user
@@ -11,6 +11,7 @@
 #include "fs/stat.h"
 #include "lock/sleeplock.h"
 #include "lock/spin_lock.h"
+#include "process/proc_mm.h"
 #include "process/process.h"
 
 struct devsw devsw[NDEV];
@@ -102,6 +103,9 @@ int fileread(struct file *f, uint64 addr, int n)
     if (f->readable == 0)
         return -1;
 
+    // pages of addr may be read from files, not with the locks below, which
+    // include the spin locks of pipes and devices
+    mm_prefault(addr, n, FAULT_WRITE);
     if (f->type == FD_PIPE) {
         r = piperead(f->pipe, addr, n);
     } else if (f->type == FD_DEVICE) {
@@ -109,10 +113,12 @@ int fileread(struct file *f, uint64 addr, int n)
             return -1;
         r = devsw[f->major].read(1, addr, n);
     } else if (f->type == FD_INODE) {
+        myproc()->in_fs_op = 1;
         ilock(f->ip);
         if ((r = readi(f->ip, 1, addr, f->off, n)) > 0)
             f->off += r;
         iunlock(f->ip);
+        myproc()->in_fs_op = 0;
     } else {
         panic("fileread");
     }
@@ -129,6 +135,7 @@ int filewrite(struct file *f, uint64 addr, int n)
     if (f->writable == 0)
         return -1;
 
+    mm_prefault(addr, n, FAULT_READ);
     if (f->type == FD_PIPE) {
         ret = pipewrite(f->pipe, addr, n);
     } else if (f->type == FD_DEVICE) {
@@ -149,12 +156,14 @@ int filewrite(struct file *f, uint64 addr, int n)
             if (n1 > max)
                 n1 = max;
 
+            myproc()->in_fs_op = 1;
             begin_op();
             ilock(f->ip);
             if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
                 f->off += r;
             iunlock(f->ip);
             end_op();
+            myproc()->in_fs_op = 0;
 
             if (r < 0)
                 break;
@@ -19,6 +19,7 @@
 #include "fs/stat.h"
 #include "lock/sleeplock.h"
 #include "lock/spin_lock.h"
+#include "process/exec_image.h"
 #include "process/process.h"
 #include "util/string.h"
 
@@ -399,6 +400,8 @@ void itrunc(struct inode *ip)
     struct buf *bp;
     uint *a;
 
+    exec_image_invalidate(ip);
+
     for (i = 0; i < NDIRECT; i++) {
         if (ip->addrs[i]) {
             bfree(ip->dev, ip->addrs[i]);
@@ -472,6 +475,8 @@ int writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
         return -1;
     if (off + n > MAXFILE * BSIZE)
         return -1;
+    if (n > 0)
+        exec_image_invalidate(ip);
 
     for (tot = 0; tot < n; tot += m, off += m, src += m) {
         bp = bread(ip->dev, bmap(ip, off / BSIZE));
@@ -604,8 +609,13 @@ static struct inode *namex(char *path, int nameiparent, char *name)
 
     if (*path == '/')
         ip = iget(ROOTDEV, ROOTINO);
-    else
-        ip = idup(my_proc()->cwd);
+    else {
+        // cwd may be changed by another thread
+        struct proc_files *files = my_proc()->files;
+        acquire_spin_lock(&files->lock);
+        ip = idup(files->cwd);
+        release_spin_lock(&files->lock);
+    }
 
     while ((path = skipelem(path, name)) != 0) {
         ilock(ip);
@@ -15,14 +15,17 @@
 #include "lock/sleeplock.h"
 #include "lock/spin_lock.h"
 #include "process/process.h"
+#include "syscall/mman.h"
 #include "syscall/syscall.h"
+#include "syscall/uvm.h"
 #include "util/string.h"
 
 // Fetch the uint64 at addr from the current process.
 int fetchaddr(uint64 addr, uint64 *ip)
 {
     struct process *p = myproc();
-    if (addr >= p->mem_end || addr + sizeof(uint64) > p->mem_end)
+    uint64 mem_end = READ_ONCE(p->mm->mem_end);
+    if (addr >= mem_end || addr + sizeof(uint64) > mem_end)
         return -1;
     if (copyin(p->proc_pgtable, (char *)ip, addr, sizeof(*ip)) != 0)
         return -1;
@@ -70,20 +73,24 @@ int argstr(int n, char *buf, int max)
 }
 
 // Fetch the nth word-sized system call argument as a file descriptor
-// and return both the descriptor and the corresponding struct file.
-static int argfd(int n, int *pfd, struct file **pf)
+// and return the corresponding struct file with a reference taken, so
+// that a thread closing fd meanwhile can not free it. Drop it by fileclose().
+static int argfd(int n, struct file **pf)
 {
     int fd;
     struct file *f;
+    struct proc_files *files = myproc()->files;
 
-    if (argint(n, &fd) < 0)
+    if (argint(n, &fd) < 0 || fd < 0 || fd >= NOFILE)
         return -1;
-    if (fd < 0 || fd >= NOFILE || (f = myproc()->ofile[fd]) == 0)
+    acquire_spin_lock(&files->lock);
+    if ((f = files->ofile[fd]) == 0) {
+        release_spin_lock(&files->lock);
         return -1;
-    if (pfd)
-        *pfd = fd;
-    if (pf)
-        *pf = f;
+    }
+    filedup(f);
+    release_spin_lock(&files->lock);
+    *pf = f;
     return 0;
 }
 
@@ -92,51 +99,97 @@ static int argfd(int n, int *pfd, struct file **pf)
 static int fdalloc(struct file *f)
 {
     int fd;
-    struct process *p = myproc();
+    struct proc_files *files = myproc()->files;
 
+    acquire_spin_lock(&files->lock);
     for (fd = 0; fd < NOFILE; fd++) {
-        if (p->ofile[fd] == 0) {
-            p->ofile[fd] = f;
+        if (files->ofile[fd] == 0) {
+            files->ofile[fd] = f;
+            release_spin_lock(&files->lock);
             return fd;
         }
     }
+    release_spin_lock(&files->lock);
     return -1;
 }
 
+// Clear fd if it holds f, or any file if f is 0, and return the file
+// cleared, 0 if none. The caller drops the reference of fd by fileclose().
+static struct file *fdfree(struct proc_files *files, int fd, struct file *f)
+{
+    struct file *old;
+
+    acquire_spin_lock(&files->lock);
+    old = files->ofile[fd];
+    if (old == 0 || (f != 0 && old != f)) {
+        release_spin_lock(&files->lock);
+        return 0;
+    }
+    files->ofile[fd] = 0;
+    release_spin_lock(&files->lock);
+    return old;
+}
+
 uint64 sys_dup(void)
 {
     struct file *f;
     int fd;
 
-    if (argfd(0, 0, &f) < 0)
+    if (argfd(0, &f) < 0)
         return -1;
-    if ((fd = fdalloc(f)) < 0)
+    // the reference of argfd goes to the new fd
+    if ((fd = fdalloc(f)) < 0) {
+        fileclose(f);
         return -1;
-    filedup(f);
+    }
     return fd;
 }
 
 uint64 sys_read(void)
 {
     struct file *f;
-    int n;
+    int n, r;
     uint64 p;
 
-    if (argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argaddr(1, &p) < 0)
+    if (argint(2, &n) < 0 || argaddr(1, &p) < 0 || argfd(0, &f) < 0)
         return -1;
-    return fileread(f, p, n);
+    r = fileread(f, p, n);
+    fileclose(f);
+    return r;
 }
 
 uint64 sys_write(void)
 {
     struct file *f;
-    int n;
+    int n, r;
     uint64 p;
 
-    if (argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argaddr(1, &p) < 0)
+    if (argint(2, &n) < 0 || argaddr(1, &p) < 0 || argfd(0, &f) < 0)
         return -1;
+    r = filewrite(f, p, n);
+    fileclose(f);
+    return r;
+}
+
+// map a file or zeroed memory, see mmap() in syscall/uvm.c
+uint64 sys_mmap(void)
+{
+    uint64 length, off, r;
+    int prot, flags;
+    struct file *f = 0;
 
-    return filewrite(f, p, n);
+    if (argaddr(1, &length) < 0 || argint(2, &prot) < 0 ||
+        argint(3, &flags) < 0 || argaddr(5, &off) < 0)
+        return -1;
+    if (flags & MAP_ANONYMOUS)
+        return mmap(myproc(), length, prot, flags, 0, off);
+    if (argfd(4, &f) < 0)
+        return -1;
+    r = -1;
+    if (f->type == FD_INODE && f->readable)
+        r = mmap(myproc(), length, prot, flags, f->ip, off);
+    fileclose(f);
+    return r;
 }
 
 uint64 sys_close(void)
@@ -144,9 +197,11 @@ uint64 sys_close(void)
     int fd;
     struct file *f;
 
-    if (argfd(0, &fd, &f) < 0)
+    if (argint(0, &fd) < 0 || fd < 0 || fd >= NOFILE)
+        return -1;
+    // another thread may close fd at the same time, only one gets it
+    if ((f = fdfree(myproc()->files, fd, 0)) == 0)
         return -1;
-    myproc()->ofile[fd] = 0;
     fileclose(f);
     return 0;
 }
@@ -155,10 +210,13 @@ uint64 sys_fstat(void)
 {
     struct file *f;
     uint64 st; // user pointer to struct stat
+    int r;
 
-    if (argfd(0, 0, &f) < 0 || argaddr(1, &st) < 0)
+    if (argaddr(1, &st) < 0 || argfd(0, &f) < 0)
         return -1;
-    return filestat(f, st);
+    r = filestat(f, st);
+    fileclose(f);
+    return r;
 }
 
 // Create the path new as a link to the same inode as old.
@@ -443,9 +501,12 @@ uint64 sys_chdir(void)
         return -1;
     }
     iunlock(ip);
-    iput(p->cwd);
+    acquire_spin_lock(&p->files->lock);
+    struct inode *old_cwd = p->files->cwd;
+    p->files->cwd = ip;
+    release_spin_lock(&p->files->lock);
+    iput(old_cwd);
     end_op();
-    p->cwd = ip;
     return 0;
 }
 
@@ -462,19 +523,19 @@ uint64 sys_pipe(void)
         return -1;
     fd0 = -1;
     if ((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0) {
-        if (fd0 >= 0)
-            p->ofile[fd0] = 0;
-        fileclose(rf);
+        // a thread may have closed fd0 already, it dropped rf then
+        if (fd0 < 0 || fdfree(p->files, fd0, rf))
+            fileclose(rf);
         fileclose(wf);
         return -1;
     }
     if (copyout(p->proc_pgtable, fdarray, (char *)&fd0, sizeof(fd0)) < 0 ||
         copyout(p->proc_pgtable, fdarray + sizeof(fd0), (char *)&fd1,
                 sizeof(fd1)) < 0) {
-        p->ofile[fd0] = 0;
-        p->ofile[fd1] = 0;
-        fileclose(rf);
-        fileclose(wf);
+        if (fdfree(p->files, fd0, rf))
+            fileclose(rf);
+        if (fdfree(p->files, fd1, wf))
+            fileclose(wf);
         return -1;
     }
     return 0;
@@ -33,6 +33,22 @@ void acquire_spin_lock(struct spin_lock *lock)
     lock->cpu_id = cpu_id();
 }
 
+// return 0 if lock is acquired, -1 if others hold it
+int try_acquire_spin_lock(struct spin_lock *lock)
+{
+    push_introff();
+    check_not_hold(lock);
+    if (__sync_lock_test_and_set(&lock->locked, 1)) {
+        pop_introff();
+        return -1;
+    }
+    __sync_synchronize();
+
+    // lock acquire
+    lock->cpu_id = cpu_id();
+    return 0;
+}
+
 void release_spin_lock(struct spin_lock *lock)
 {
     check_hold(lock);
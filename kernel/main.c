@@ -15,6 +15,10 @@
 #include "riscv/plic.h"
 #include "riscv/regs.h"
 #include "scheduler/scheduler.h"
+#include "scheduler/sleep.h"
+#include "scheduler/timer.h"
+#include "syscall/futex.h"
+#include "syscall/shm.h"
 #include "trap/kernel_trap.h"
 #include "util/kprint.h"
 #include "vm/kalloc.h"
@@ -43,6 +47,10 @@ void main(void)
         virtio_disk_init();
 
         process_init(); // process and proc group
+        sleep_init();
+        futex_init();
+        shm_init();
+        timer_init();
         proc_group_init();
         setup_init_proc(); // also do proc group init hart here
 
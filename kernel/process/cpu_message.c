@@ -1,62 +1,131 @@
 #include "process/cpu_message.h"
-#include "lock/spin_lock.h"
-#include "scheduler/sleep.h"
+#include "cpus.h"
+#include "process/proc_group.h"
+#include "scheduler/scheduler.h"
+#include "trap/intr_handler.h"
+#include "trap/introff.h"
+#include "util/cpumask.h"
 #include "util/kprint.h"
 
 const struct cpu_message EMPTY = { EMP_MESSAGE, NULL };
 
-struct {
-    struct cpu_message box[CPU_MESSAGE_BOX_SIZE];
-    uint64 box_beg, box_end;
-    __attribute__((aligned(8))) uint64 size;
-    struct spin_lock lock;
-} um_box;
+#define CELL_MASK (CPU_MESSAGE_BOX_SIZE - 1)
 
-void init_cpu_message(void) { init_spin_lock(&um_box.lock); }
-
-static int box_empty(void) { return um_box.size == 0; }
+void init_cpu_mailbox(struct cpu_mailbox *box)
+{
+    if (CPU_MESSAGE_BOX_SIZE & CELL_MASK) {
+        PANIC_FN("mailbox size is not power of 2");
+    }
+    for (uint64 i = 0; i < CPU_MESSAGE_BOX_SIZE; i++) {
+        box->cells[i].seq = i;
+        box->cells[i].m = EMPTY;
+    }
+    box->send_pos = 0;
+    box->recv_pos = 0;
+}
 
-static int box_full(void) { return um_box.size == CPU_MESSAGE_BOX_SIZE; }
+// racy check, return 1 if the cpu may have message
+int has_cpu_message(int cpu_id)
+{
+    struct cpu_mailbox *box = &cpus[cpu_id].mailbox;
+    return __atomic_load_n(&box->send_pos, __ATOMIC_RELAXED) !=
+           __atomic_load_n(&box->recv_pos, __ATOMIC_RELAXED);
+}
 
-uint64 no_message_atomic(void)
+// return -1 if the mailbox is full
+static int mailbox_put(struct cpu_mailbox *box, struct cpu_message m)
 {
-    return __atomic_load_n(&um_box.size, __ATOMIC_RELAXED) == 0;
+    uint64 pos = __atomic_load_n(&box->send_pos, __ATOMIC_RELAXED);
+    while (1) {
+        uint64 seq =
+            __atomic_load_n(&box->cells[pos & CELL_MASK].seq, __ATOMIC_ACQUIRE);
+        int64 dif = (int64)seq - (int64)pos;
+        if (dif < 0) {
+            return -1;
+        }
+        // on failure pos is reloaded
+        if (dif == 0 &&
+            __atomic_compare_exchange_n(&box->send_pos, &pos, pos + 1, 0,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            break;
+        }
+        if (dif > 0) {
+            pos = __atomic_load_n(&box->send_pos, __ATOMIC_RELAXED);
+        }
+    }
+    box->cells[pos & CELL_MASK].m = m;
+    __atomic_store_n(&box->cells[pos & CELL_MASK].seq, pos + 1,
+                     __ATOMIC_RELEASE);
+    return 0;
 }
 
-struct cpu_message get_cpu_message(void)
+// only the owner takes, return EMPTY if there is no message
+static struct cpu_message mailbox_take(struct cpu_mailbox *box)
 {
-    acquire_spin_lock(&um_box.lock);
-    if (box_empty()) {
-        release_spin_lock(&um_box.lock);
+    uint64 pos = box->recv_pos;
+    uint64 seq =
+        __atomic_load_n(&box->cells[pos & CELL_MASK].seq, __ATOMIC_ACQUIRE);
+    if (seq != pos + 1) {
         return EMPTY;
     }
+    struct cpu_message m = box->cells[pos & CELL_MASK].m;
+    __atomic_store_n(&box->recv_pos, pos + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&box->cells[pos & CELL_MASK].seq,
+                     pos + CPU_MESSAGE_BOX_SIZE, __ATOMIC_RELEASE);
+    return m;
+}
 
-    struct cpu_message m = um_box.box[um_box.box_beg % CPU_MESSAGE_BOX_SIZE];
-    um_box.box_beg++;
-    __atomic_fetch_sub(&um_box.size, 1, __ATOMIC_RELAXED);
-    release_spin_lock(&um_box.lock);
-    if (m.type != NEED_CPU && m.type != NEED_CPU_FLEX) {
+// call by scheduler, take a message from my mailbox
+struct cpu_message get_cpu_message(void)
+{
+    struct cpu_message m = mailbox_take(&my_cpu_unsafe()->mailbox);
+    if (m.type != EMP_MESSAGE && m.type != NEED_CPU &&
+        m.type != NEED_CPU_FLEX && m.type != PGROUP_SHRINK) {
         PANIC_FN("get unknow message");
     }
     return m;
 }
 
-void resend_cpu_message(struct cpu_message m)
+// send message to the cpu, return -1 if its mailbox is full
+int send_cpu_message_to(int cpu_id, struct cpu_message m)
 {
-    if (m.type != EMP_MESSAGE) {
-        send_cpu_message(m);
+    struct cpu *target = &cpus[cpu_id];
+    if (mailbox_put(&target->mailbox, m)) {
+        return -1;
+    }
+    __sync_synchronize();
+    if (claim_idle_cpu(target) == 0) {
+        kick_cpu(cpu_id);
     }
+    return 0;
 }
 
-void send_cpu_message(struct cpu_message m)
+// send message to a free cpu, idle one first. return -1 if all free cpus'
+// mailboxes are full, sender shall back off
+int send_cpu_message(struct cpu_message m)
 {
-    acquire_spin_lock(&um_box.lock);
-    if (box_full()) {
-        PANIC_FN("cpu message box full");
+    struct proc_group *pgroup = get_proc_group(DEFAULT_PGROUP_ID);
+    struct cpu *idle = claim_idle_cpu_in_pgroup(pgroup, -1, CPUMASK_POSSIBLE);
+    if (idle != NULL) {
+        int err = mailbox_put(&idle->mailbox, m);
+        kick_cpu(idle->cpu_id);
+        if (err == 0) {
+            return 0;
+        }
     }
 
-    um_box.box[um_box.box_end % CPU_MESSAGE_BOX_SIZE] = m;
-    um_box.box_end++;
-    __atomic_add_fetch(&um_box.size, 1, __ATOMIC_RELAXED);
-    release_spin_lock(&um_box.lock);
+    // cpus may change without lock, a cpu got message after it leaves will
+    // forward it
+    push_introff();
+    int start = cpu_id();
+    pop_introff();
+    cpumask_t mask = READ_ONCE(pgroup->cpus);
+    int n = cpumask_weight(mask);
+    for (int id = start; n > 0; n--) {
+        id = cpumask_next_wrap(mask, id);
+        if (send_cpu_message_to(id, m) == 0) {
+            return 0;
+        }
+    }
+    return -1;
 }
@@ -0,0 +1,136 @@
+#include "process/exec_image.h"
+#include "config/basic_config.h"
+#include "fs/file.h"
+#include "lock/spin_lock.h"
+#include "util/kprint.h"
+#include "vm/kalloc.h"
+
+struct exec_image images[EXEC_IMAGE_NUM];
+uint64 images_clock;
+// protect all images
+struct spin_lock images_lock;
+
+void exec_image_init(void) { init_spin_lock(&images_lock); }
+
+// call with images lock, give back pages of image
+static void drop_pages(struct exec_image *image)
+{
+    for (int i = 0; i < EXEC_IMAGE_PAGES; i++) {
+        if (image->pages[i].page != NULL) {
+            kfree(image->pages[i].page);
+            image->pages[i].page = NULL;
+        }
+    }
+}
+
+// image without ref to replace, invalid ones first as they hold no page
+static int better_victim(struct exec_image *image, struct exec_image *victim)
+{
+    if (image->ref) {
+        return 0;
+    }
+    if (victim == NULL) {
+        return 1;
+    }
+    if (victim->valid == 0) {
+        return 0;
+    }
+    return image->valid == 0 || image->last_used < victim->last_used;
+}
+
+// return the image of ip with a reference, NULL if all images are in use
+struct exec_image *get_exec_image(struct inode *ip)
+{
+    acquire_spin_lock(&images_lock);
+    struct exec_image *found = NULL;
+    struct exec_image *victim = NULL;
+    for (int i = 0; i < EXEC_IMAGE_NUM && found == NULL; i++) {
+        struct exec_image *image = &images[i];
+        if (image->valid && image->dev == ip->dev && image->inum == ip->inum) {
+            found = image;
+        } else if (better_victim(image, victim)) {
+            victim = image;
+        }
+    }
+    if (found == NULL && victim == NULL) {
+        release_spin_lock(&images_lock);
+        return NULL;
+    }
+
+    if (found == NULL) {
+        found = victim;
+        drop_pages(found);
+        found->dev = ip->dev;
+        found->inum = ip->inum;
+        found->valid = 1;
+    }
+    found->ref++;
+    found->last_used = ++images_clock;
+    release_spin_lock(&images_lock);
+    return found;
+}
+
+void dup_exec_image(struct exec_image *image)
+{
+    acquire_spin_lock(&images_lock);
+    image->ref++;
+    release_spin_lock(&images_lock);
+}
+
+void put_exec_image(struct exec_image *image)
+{
+    acquire_spin_lock(&images_lock);
+    if (image->ref <= 0) {
+        PANIC_FN("put free exec image");
+    }
+    image->ref--;
+    release_spin_lock(&images_lock);
+}
+
+// return page pgno of image with a reference, NULL if it is not cached
+void *exec_image_page(struct exec_image *image, uint64 pgno, uint n)
+{
+    if (pgno >= EXEC_IMAGE_PAGES) {
+        return NULL;
+    }
+    acquire_spin_lock(&images_lock);
+    void *page = image->pages[pgno].page;
+    if (page != NULL && image->pages[pgno].n == n) {
+        kdup(page);
+    } else {
+        page = NULL;
+    }
+    release_spin_lock(&images_lock);
+    return page;
+}
+
+// call with the inode of image locked, which page is read from. cache page if
+// page pgno is not cached yet
+void exec_image_add_page(struct exec_image *image, uint64 pgno, uint n,
+                         void *page)
+{
+    if (pgno >= EXEC_IMAGE_PAGES) {
+        return;
+    }
+    acquire_spin_lock(&images_lock);
+    if (image->valid && image->pages[pgno].page == NULL) {
+        kdup(page);
+        image->pages[pgno].page = page;
+        image->pages[pgno].n = n;
+    }
+    release_spin_lock(&images_lock);
+}
+
+// call with ip locked, before its content changes
+void exec_image_invalidate(struct inode *ip)
+{
+    acquire_spin_lock(&images_lock);
+    for (int i = 0; i < EXEC_IMAGE_NUM; i++) {
+        struct exec_image *image = &images[i];
+        if (image->valid && image->dev == ip->dev && image->inum == ip->inum) {
+            image->valid = 0;
+            drop_pages(image);
+        }
+    }
+    release_spin_lock(&images_lock);
+}
@@ -4,7 +4,12 @@
 #include "lock/spin_lock.h"
 #include "process/cpu_message.h"
 #include "process/process.h"
+#include "riscv/clint.h"
+#include "riscv/regs.h"
+#include "scheduler/sched_policy.h"
+#include "scheduler/scheduler.h"
 #include "scheduler/sleep.h"
+#include "scheduler/timer.h"
 #include "trap/intr_handler.h"
 #include "trap/introff.h"
 #include "util/kprint.h"
@@ -58,6 +63,14 @@ static void free_pgroup(struct proc_group *group)
     }
     group->id = -1;
     group->exclusively_occupy = 0;
+    group->policy = SCHED_RR;
+    run_queue_set_policy(&group->rq, SCHED_RR);
+    group->time_slice = TIME_SLICE_DEFAULT;
+    group->autoscale_target = 0;
+    group->load_avg = 0;
+    // no proc left to wait on it
+    group->barrier.n = 0;
+    group->barrier.count = 0;
 }
 
 // call with my cpu and proc group lock
@@ -66,12 +79,13 @@ static void add_my_cpu_to_pgroup(struct proc_group *group, struct cpu *mycpu)
     if (mycpu != my_cpu()) {
         PANIC_FN("add other's cpu");
     }
-    if (group->cpus[mycpu->cpu_id] != -1 || mycpu->pgroup_id != -1) {
+    if (cpumask_test(group->cpus, mycpu->cpu_id) || mycpu->pgroup_id != -1) {
         PANIC_FN("add cpu that has been added");
     }
 
-    group->cpus[mycpu->cpu_id] = mycpu->cpu_id;
+    WRITE_ONCE(group->cpus, group->cpus | cpumask_of(mycpu->cpu_id));
     mycpu->pgroup_id = group->id;
+    run_queue_open(&mycpu->rq, group->id, group->policy);
 }
 
 // call with my cpu and proc group lock
@@ -81,13 +95,19 @@ static void remove_my_cpu_from_pgroup(struct proc_group *group,
     if (mycpu != my_cpu()) {
         PANIC_FN("add other's cpu");
     }
-    if (group->cpus[mycpu->cpu_id] != mycpu->cpu_id ||
+    if (cpumask_test(group->cpus, mycpu->cpu_id) == 0 ||
         mycpu->pgroup_id != group->id) {
         PANIC_FN("remove cpu that haven't been added");
     }
 
-    group->cpus[mycpu->cpu_id] = -1;
+    WRITE_ONCE(group->cpus, group->cpus & ~cpumask_of(mycpu->cpu_id));
     mycpu->pgroup_id = -1;
+
+    // procs placed on me go back to group, other cpus in group will run them
+    struct run_queue left;
+    init_run_queue(&left, -1, SCHED_RR);
+    run_queue_close(&mycpu->rq, &left);
+    run_queue_splice(&group->rq, &left);
 }
 
 // call with my proc and proc group lock
@@ -103,10 +123,13 @@ static void add_my_proc_to_pgroup(struct proc_group *group,
 
     list_add(&myproc->pgroup_list, &group->procs_head);
     myproc->pgroup_id = group->id;
+    // vruntime of other group means nothing here
+    myproc->vruntime = __atomic_load_n(&group->min_vruntime, __ATOMIC_RELAXED);
 }
 
 // call with my proc and proc group lock
-static void remove_my_proc_from_pgroup(struct process *myproc)
+static void remove_my_proc_from_pgroup(struct proc_group *group,
+                                       struct process *myproc)
 {
     if (myproc != my_proc()) {
         PANIC_FN("add other's proc");
@@ -117,6 +140,11 @@ static void remove_my_proc_from_pgroup(struct process *myproc)
 
     list_del(&myproc->pgroup_list);
     myproc->pgroup_id = -1;
+
+    // idle cpus of the empty group shall leave it
+    if (list_empty(&group->procs_head)) {
+        kick_idle_cpus(group, 1);
+    }
 }
 
 static struct proc_group *alloc_pgroup(struct cpu *guard_cpu)
@@ -142,15 +170,21 @@ void proc_group_init(void)
     for (int i = 0; i < MAX_PROC_GROUP_NUM; i++) {
         proc_group_set[i].id = -1;
         INIT_LIST_HEAD(&proc_group_set[i].procs_head);
-        for (int j = 0; j < MAX_CPU_NUM; j++) {
-            proc_group_set[i].cpus[j] = -1;
-        }
+        proc_group_set[i].policy = SCHED_RR;
+        proc_group_set[i].time_slice = TIME_SLICE_DEFAULT;
+        init_run_queue(&proc_group_set[i].rq, i, SCHED_RR);
+        proc_group_set[i].min_vruntime = 0;
+        proc_group_set[i].autoscale_target = 0;
+        proc_group_set[i].load_avg = 0;
+        proc_group_set[i].cpus = 0;
+        proc_group_set[i].barrier.n = 0;
+        proc_group_set[i].barrier.count = 0;
+        proc_group_set[i].barrier.phase = 0;
+        init_spin_lock(&proc_group_set[i].barrier.lock);
 
         init_spin_lock(&proc_group_set[i].lock);
     }
     init_spin_lock(&free_cpus_lock);
-
-    init_cpu_message();
 }
 
 void setup_default_proc_group(struct process *proc)
@@ -178,14 +212,7 @@ void proc_group_init_hart(void)
 // call with pgroup lock
 static int pgroup_cpu_count_unsafe(struct proc_group *group)
 {
-    int n = 0;
-    for (int i = 0; i < MAX_CPU_NUM; i++) {
-        if (group->cpus[i] != -1) {
-            n++;
-        }
-    }
-
-    return n;
+    return cpumask_weight(group->cpus);
 }
 
 // call with pgroup lock and intr off, leave group
@@ -236,7 +263,7 @@ static int proc_leave_pgroup_may_with_cpu(int leave_way)
     struct proc_group *old_group = &proc_group_set[proc->pgroup_id];
 
     acquire_spin_lock(&old_group->lock);
-    remove_my_proc_from_pgroup(proc);
+    remove_my_proc_from_pgroup(old_group, proc);
     if (leave_way != WITH_CPU) {
         release_spin_lock(&old_group->lock);
         return 0;
@@ -314,6 +341,49 @@ int create_pgroup(void)
     return proc->pgroup_id;
 }
 
+// scheduling policy of current group, see scheduler/sched_policy.h
+int get_pgroup_policy(void)
+{
+    struct proc_group *pgroup = get_proc_group(my_proc()->pgroup_id);
+    acquire_spin_lock(&pgroup->lock);
+    int policy = pgroup->policy;
+    release_spin_lock(&pgroup->lock);
+    return policy;
+}
+
+// set scheduling policy of current group, see scheduler/sched_policy.h
+int set_pgroup_policy(int policy)
+{
+    if (policy != SCHED_RR && policy != SCHED_FAIR) {
+        return -1;
+    }
+
+    struct proc_group *pgroup = get_proc_group(my_proc()->pgroup_id);
+    acquire_spin_lock(&pgroup->lock);
+    pgroup->policy = policy;
+    run_queue_set_policy(&pgroup->rq, policy);
+    int i;
+    for_each_cpu(i, pgroup->cpus) {
+        run_queue_set_policy(&cpus[i].rq, policy);
+    }
+    release_spin_lock(&pgroup->lock);
+    return 0;
+}
+
+// set ticks procs of current group run before they are preempted
+int set_pgroup_time_slice(int ticks)
+{
+    if (ticks < TIME_SLICE_MIN || ticks > TIME_SLICE_MAX) {
+        return -1;
+    }
+
+    struct proc_group *pgroup = get_proc_group(my_proc()->pgroup_id);
+    acquire_spin_lock(&pgroup->lock);
+    pgroup->time_slice = ticks;
+    release_spin_lock(&pgroup->lock);
+    return 0;
+}
+
 // add current proc to group
 /*
  * you can consider require two proc group lock(acquire lock with smaller group
@@ -393,14 +463,6 @@ int cpu_leave_pgroup_if_empty(void)
     return 0;
 }
 
-// call in scheduler with pgroup lock.
-// move the proc to the tail in proc group's proc list
-void proc_move_to_tail(struct proc_group *pgroup, struct process *proc)
-{
-    list_del(&proc->pgroup_list);
-    list_add_tail(&proc->pgroup_list, &pgroup->procs_head);
-}
-
 // call by fork() to add child, only in this circumstance, we won't lost proc
 int forkproc_into_pgroup(int pgroup_id, struct process *proc)
 {
@@ -451,7 +513,12 @@ int inc_pgroup_cpus(void)
         return -1;
     }
     acquire_spin_lock(&pgroup->lock);
-    send_cpu_message((struct cpu_message){ NEED_CPU, &m });
+    err = send_cpu_message((struct cpu_message){ NEED_CPU, &m });
+    if (err) {
+        release_spin_lock(&pgroup->lock);
+        inc_free_cpus();
+        return -1;
+    }
     sleep(&pgroup->lock, m.sleep_chain);
     release_spin_lock(&pgroup->lock);
     return 0;
@@ -469,7 +536,11 @@ int inc_pgroup_cpus_flex(void)
     if (err) {
         return -1;
     }
-    send_cpu_message((struct cpu_message){ NEED_CPU_FLEX, pgroup });
+    err = send_cpu_message((struct cpu_message){ NEED_CPU_FLEX, pgroup });
+    if (err) {
+        inc_free_cpus();
+        return -1;
+    }
     return 0;
 }
 
@@ -506,18 +577,60 @@ int dec_pgroup_cpus(void)
     return 0;
 }
 
-// call by scheduler if cpu belongs to dafault group, handle cpu acquire
+// call by scheduler, i am not a free cpu, hand cpu acquire to free cpus
+static void forward_cpu_acquire(struct cpu_message m)
+{
+    // free cpus are busy, keep it and retry later, we just made room
+    if (send_cpu_message(m) && send_cpu_message_to(cpu_id_unsafe(), m)) {
+        PANIC_FN("lost cpu message");
+    }
+}
+
+// call by scheduler, autoscale asks me to leave pgroup
+static void autoscale_shrink_my_cpu(struct proc_group *pgroup)
+{
+    push_introff();
+    struct cpu *mycpu = my_cpu();
+    acquire_spin_lock(&pgroup->lock);
+    // group may change since the message is sent
+    if (mycpu->pgroup_id != pgroup->id || pgroup->exclusively_occupy ||
+        pgroup_cpu_count_unsafe(pgroup) <= pgroup->autoscale_min ||
+        cpu_leave_pgroup()) {
+        release_spin_lock(&pgroup->lock);
+        pop_introff();
+        return;
+    }
+    release_spin_lock(&pgroup->lock);
+
+    struct proc_group *default_group = get_default_pgroup();
+    acquire_spin_lock(&default_group->lock);
+    add_my_cpu_to_pgroup(default_group, mycpu);
+    release_spin_lock(&default_group->lock);
+    inc_free_cpus();
+    pop_introff();
+}
+
+// call by scheduler, handle cpu acquire sent to my cpu
 void handle_cpu_acquire(void)
 {
     struct cpu *mycpu = my_cpu_unsafe();
-    if (mycpu->pgroup_id != DEFAULT_PGROUP_ID) {
-        PANIC_FN("other proc group cpus want to handle cpu acquire");
-    }
-    if (no_message_atomic()) {
+    if (has_cpu_message(mycpu->cpu_id) == 0) {
         return;
     }
 
     struct cpu_message m = get_cpu_message();
+    if (m.type == PGROUP_SHRINK) {
+        autoscale_shrink_my_cpu(m.message);
+        return;
+    }
+    if (m.type == EMP_MESSAGE) {
+        return;
+    }
+    if (mycpu->pgroup_id != DEFAULT_PGROUP_ID) {
+        forward_cpu_acquire(m);
+        return;
+    }
+
     struct need_cpu_message *mm = m.message;
     struct proc_group *old_group = get_default_pgroup();
     struct proc_group *new_group;
@@ -527,7 +640,6 @@ void handle_cpu_acquire(void)
     } else if (m.type == NEED_CPU_FLEX) {
         new_group = m.message;
     } else {
-        resend_cpu_message(m);
         return;
     }
 
@@ -559,6 +671,100 @@ void handle_cpu_acquire(void)
     release_spin_lock(&new_group->lock);
 }
 
+/*
+ * let kernel move cpus between current group and default group, so that every
+ * cpu has about target_load percent of load. load is running and RUNABLE
+ * procs, 100 for a proc. cpu count stays in [min_cpus, max_cpus].
+ * target_load 0 turns it off. fail in default group.
+ */
+int set_pgroup_autoscale(int min_cpus, int max_cpus, int target_load)
+{
+    struct process *proc = my_proc();
+    if (proc->pgroup_id == DEFAULT_PGROUP_ID || target_load < 0 ||
+        min_cpus < 1 || max_cpus < min_cpus || max_cpus > MAX_CPU_NUM) {
+        return -1;
+    }
+
+    struct proc_group *pgroup = get_proc_group(proc->pgroup_id);
+    acquire_spin_lock(&pgroup->lock);
+    pgroup->autoscale_min = min_cpus;
+    pgroup->autoscale_max = max_cpus;
+    pgroup->autoscale_target = target_load;
+    release_spin_lock(&pgroup->lock);
+    return 0;
+}
+
+#define AUTOSCALE_PERIOD 5 // ticks
+
+uint64 next_autoscale_tick;
+
+// call with intr off, sample load of pgroup and move a cpu if needed
+static void autoscale_pgroup(struct proc_group *pgroup)
+{
+    // racy check, most groups don't autoscale
+    if (READ_ONCE(pgroup->autoscale_target) == 0) {
+        return;
+    }
+    acquire_spin_lock(&pgroup->lock);
+    if (pgroup->id == -1 || pgroup->autoscale_target == 0 ||
+        pgroup->exclusively_occupy) {
+        release_spin_lock(&pgroup->lock);
+        return;
+    }
+
+    int ncpus = cpumask_weight(pgroup->cpus);
+    int load = run_queue_len(&pgroup->rq);
+    int shrink_cpu = -1;
+    int i;
+    for_each_cpu(i, pgroup->cpus) {
+        load += run_queue_len(&cpus[i].rq);
+        // a cpu lent to default group runs none of ours
+        load += READ_ONCE(cpus[i].my_proc) != NULL &&
+                READ_ONCE(cpus[i].lent) == 0;
+        // leaving an idle cpu costs nothing
+        if (shrink_cpu == -1 || READ_ONCE(cpus[i].idle)) {
+            shrink_cpu = i;
+        }
+    }
+    pgroup->load_avg = (pgroup->load_avg * 3 + load * 100) / 4;
+
+    int want = (pgroup->load_avg + pgroup->autoscale_target - 1) /
+               pgroup->autoscale_target;
+    if (want < pgroup->autoscale_min) {
+        want = pgroup->autoscale_min;
+    } else if (want > pgroup->autoscale_max) {
+        want = pgroup->autoscale_max;
+    }
+    release_spin_lock(&pgroup->lock);
+
+    if (want > ncpus) {
+        if (dec_free_cpus() == 0 &&
+            send_cpu_message((struct cpu_message){ NEED_CPU_FLEX, pgroup })) {
+            inc_free_cpus();
+        }
+    } else if (want < ncpus) {
+        send_cpu_message_to(shrink_cpu,
+                            (struct cpu_message){ PGROUP_SHRINK, pgroup });
+    }
+}
+
+// call on tick with intr off, the first cpu ticks in a period does autoscale
+void pgroup_autoscale_tick(uint64 now)
+{
+    uint64 next = __atomic_load_n(&next_autoscale_tick, __ATOMIC_RELAXED);
+    if (now < next ||
+        __atomic_compare_exchange_n(&next_autoscale_tick, &next,
+                                    now + AUTOSCALE_PERIOD, 0,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED) == 0) {
+        return;
+    }
+    for (int i = 0; i < MAX_PROC_GROUP_NUM; i++) {
+        if (i != DEFAULT_PGROUP_ID) {
+            autoscale_pgroup(&proc_group_set[i]);
+        }
+    }
+}
+
 int proc_occupy_cpu(void)
 {
     struct process *proc = my_proc();
@@ -575,6 +781,7 @@ int proc_occupy_cpu(void)
     }
     pgroup->exclusively_occupy = 1;
     enable_soft_intr();
+    tick_oneshot(TIMER_NO_EXPIRES);
     release_spin_lock(&pgroup->lock);
     return 0;
 }
@@ -595,6 +802,7 @@ int proc_release_cpu(void)
     }
     pgroup->exclusively_occupy = 0;
     enable_soft_n_external_intr();
+    tick_periodic();
     release_spin_lock(&pgroup->lock);
     return 0;
 }
@@ -604,3 +812,77 @@ int is_exclusive_occupy(struct process *proc)
     // we don't acquire lock as we will use it in stable environment
     return get_proc_group(proc->pgroup_id)->exclusively_occupy;
 }
+
+// set procs pgroup_barrier_wait() waits for, fail if some are waiting
+int pgroup_barrier_init(int n)
+{
+    if (n <= 0) {
+        return -1;
+    }
+
+    struct proc_group *pgroup = get_proc_group(my_proc()->pgroup_id);
+    struct pgroup_barrier *barrier = &pgroup->barrier;
+    acquire_spin_lock(&barrier->lock);
+    if (barrier->count != 0) {
+        release_spin_lock(&barrier->lock);
+        return -1;
+    }
+    barrier->n = n;
+    release_spin_lock(&barrier->lock);
+    return 0;
+}
+
+// call with barrier lock, sleep until phase is passed. return -1 if killed
+static int pgroup_barrier_sleep(struct pgroup_barrier *barrier, uint64 phase)
+{
+    struct process *proc = my_proc();
+    while (barrier->phase == phase) {
+        if (proc->killed) {
+            barrier->count--;
+            return -1;
+        }
+        sleep(&barrier->lock, &barrier->phase);
+    }
+    return 0;
+}
+
+/*
+ * wait for n procs of my group to arrive, the last one wakes all others at
+ * once. when every waiter may have its own cpu, waiters spin for a while
+ * before sleeping, as the others are likely running.
+ */
+int pgroup_barrier_wait(void)
+{
+    struct proc_group *pgroup = get_proc_group(my_proc()->pgroup_id);
+    struct pgroup_barrier *barrier = &pgroup->barrier;
+
+    acquire_spin_lock(&barrier->lock);
+    if (barrier->n == 0) {
+        release_spin_lock(&barrier->lock);
+        return -1;
+    }
+    uint64 phase = barrier->phase;
+    if (++barrier->count == barrier->n) {
+        barrier->count = 0;
+        WRITE_ONCE(barrier->phase, phase + 1);
+        wake_up(&barrier->phase);
+        release_spin_lock(&barrier->lock);
+        return 1;
+    }
+    int spin = cpumask_weight(READ_ONCE(pgroup->cpus)) >= barrier->n;
+    release_spin_lock(&barrier->lock);
+
+    if (spin) {
+        uint64 start = READ_REG(CLINT_MTIME);
+        while (READ_ONCE(barrier->phase) == phase) {
+            if (READ_REG(CLINT_MTIME) - start > PGROUP_BARRIER_SPIN) {
+                break;
+            }
+        }
+    }
+
+    acquire_spin_lock(&barrier->lock);
+    int err = pgroup_barrier_sleep(barrier, phase);
+    release_spin_lock(&barrier->lock);
+    return err ? -1 : 0;
+}
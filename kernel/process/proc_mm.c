@@ -0,0 +1,614 @@
+#include "process/proc_mm.h"
+#include "config/basic_config.h"
+#include "cpus.h"
+#include "fs/defs.h"
+#include "fs/file.h"
+#include "lock/spin_lock.h"
+#include "process/exec_image.h"
+#include "process/process.h"
+#include "riscv/vm_system.h"
+#include "syscall/shm.h"
+#include "trap/intr_handler.h"
+#include "trap/introff.h"
+#include "trap/trampoline.h"
+#include "util/arithmetic.h"
+#include "util/cpumask.h"
+#include "util/kprint.h"
+#include "util/list.h"
+#include "vm/kalloc.h"
+#include "vm/memory_layout.h"
+#include "vm/slab.h"
+#include "vm/vm.h"
+
+struct slab_cache mm_cache;
+struct slab_cache region_cache;
+
+void proc_mm_init(void)
+{
+    init_slab_cache(&mm_cache, sizeof(struct proc_mm), 0, NULL);
+    init_slab_cache(&region_cache, sizeof(struct mm_region), 0, NULL);
+}
+
+// return mm with only trampoline mapped, NULL if out of memory
+struct proc_mm *alloc_mm(void)
+{
+    struct proc_mm *mm = slab_alloc(&mm_cache);
+    if (mm == NULL) {
+        return NULL;
+    }
+    mm->pgtable = get_pagetable();
+    if (mm->pgtable == NULL) {
+        slab_free(&mm_cache, mm);
+        return NULL;
+    }
+    if (map_page(mm->pgtable, TRAMPOLINE_BASE,
+                 ROUND_DOWN_PGSIZE(user_trap_entry), PTE_R | PTE_X)) {
+        free_page_table(mm->pgtable);
+        slab_free(&mm_cache, mm);
+        return NULL;
+    }
+
+    mm->mem_start = PROC_VA_START;
+    mm->mem_brk = PROC_VA_START;
+    mm->mem_end = PROC_VA_START;
+    mm->thread_slots = 0;
+    INIT_LIST_HEAD(&mm->regions);
+    mm->regions_gen = 0;
+    mm->ref = 1;
+    init_spin_lock(&mm->lock);
+    mm->active_cpus = 0;
+    return mm;
+}
+
+void get_mm(struct proc_mm *mm)
+{
+    acquire_spin_lock(&mm->lock);
+    mm->ref++;
+    release_spin_lock(&mm->lock);
+}
+
+// free user memory with the last thread, its slot shall be unmapped. it may
+// sleep to put inodes of regions
+void put_mm(struct proc_mm *mm)
+{
+    acquire_spin_lock(&mm->lock);
+    int ref = --mm->ref;
+    release_spin_lock(&mm->lock);
+    if (ref) {
+        return;
+    }
+
+    if (mm->thread_slots) {
+        PANIC_FN("free mm with threads");
+    }
+    unmap_n_pages_free_hole(mm->pgtable, PROC_VA_START,
+                            (mm->mem_end - PROC_VA_START) / PGSIZE);
+    free_region_pages(mm->pgtable, &mm->regions);
+    free_page_table(mm->pgtable);
+    free_regions(&mm->regions);
+    slab_free(&mm_cache, mm);
+}
+
+// map ustack and trap_frame pages to a free slot, try slot first if it is not
+// -1. return the slot, -1 if there is none
+int mm_map_thread_slot(struct proc_mm *mm, int slot, void *ustack,
+                       void *trap_frame)
+{
+    acquire_spin_lock(&mm->lock);
+    uint64 free_slots = ~mm->thread_slots & ((1UL << MAX_THREAD_NUM) - 1);
+    if (slot == -1 || (free_slots & (1UL << slot)) == 0) {
+        slot = cpumask_first(free_slots);
+    }
+    if (slot == -1) {
+        release_spin_lock(&mm->lock);
+        return -1;
+    }
+
+    int err = map_page(mm->pgtable, USTACK_VA(slot), (uint64)ustack,
+                       PTE_R | PTE_W | PTE_U);
+    if (err) {
+        release_spin_lock(&mm->lock);
+        return -1;
+    }
+    err = map_page(mm->pgtable, TRAPFRAME_VA(slot), (uint64)trap_frame,
+                   PTE_R | PTE_W);
+    if (err) {
+        unmap_page(mm->pgtable, USTACK_VA(slot));
+        release_spin_lock(&mm->lock);
+        return -1;
+    }
+    mm->thread_slots |= 1UL << slot;
+    release_spin_lock(&mm->lock);
+    return slot;
+}
+
+// unmap and free ustack, with the pages it grows, and trap frame of slot
+void mm_unmap_thread_slot(struct proc_mm *mm, int slot)
+{
+    acquire_spin_lock(&mm->lock);
+    if ((mm->thread_slots & (1UL << slot)) == 0) {
+        PANIC_FN("unmap unused thread slot");
+    }
+    // ustack and trap frame are next to each other
+    mm_unmap_pages(mm, USTACK_LIMIT(slot), USTACK_MAX_PAGES + 1);
+    mm->thread_slots &= ~(1UL << slot);
+    release_spin_lock(&mm->lock);
+}
+
+// pages unmapped from mm or made read only, wait for cpus that may cache them
+// in TLB to trap
+void mm_flush_tlb(struct proc_mm *mm)
+{
+    __sync_synchronize();
+    cpumask_t others = __atomic_load_n(&mm->active_cpus, __ATOMIC_SEQ_CST) &
+                       ~cpumask_of(cpu_id());
+    uint64 traps[MAX_CPU_NUM];
+    int i;
+    for_each_cpu(i, others) {
+        traps[i] = READ_ONCE(cpus[i].user_traps);
+        kick_cpu(i);
+    }
+    for_each_cpu(i, others) {
+        // once it traps, it runs with the new mapping even if active again
+        while (cpumask_test(__atomic_load_n(&mm->active_cpus, __ATOMIC_SEQ_CST),
+                            i) &&
+               READ_ONCE(cpus[i].user_traps) == traps[i]) {
+        }
+    }
+}
+
+// call with mm lock, unmap n pages from va and free them, skip holes
+void mm_unmap_pages(struct proc_mm *mm, uint64 va, int n)
+{
+    unmap_n_pages_keep(mm->pgtable, va, n);
+    mm_flush_tlb(mm);
+    free_kept_pages(mm->pgtable, va, n);
+}
+
+// call with intr off, my cpu runs in user mode with mm from now on
+void mm_activate(struct proc_mm *mm)
+{
+    __atomic_fetch_or(&mm->active_cpus, cpumask_of(cpu_id()),
+                      __ATOMIC_SEQ_CST);
+}
+
+// call with intr off, my cpu trapped from user mode with mm and TLB is flushed
+void mm_deactivate(struct proc_mm *mm)
+{
+    struct cpu *mycpu = my_cpu();
+    __atomic_fetch_and(&mm->active_cpus, ~cpumask_of(mycpu->cpu_id),
+                       __ATOMIC_SEQ_CST);
+    WRITE_ONCE(mycpu->user_traps, mycpu->user_traps + 1);
+}
+
+// call with mm lock, give the page of target a private writable copy
+static int break_cow(struct proc_mm *mm, pte *target)
+{
+    void *page = (void *)PTE_GET_PA(*target);
+    uint64 attribute = (PTE_GET_ATTRIBUTE(*target) | PTE_W) & ~PTE_COW;
+    // others only drop their references, it is still ours alone after check
+    if (kref_count(page) == 1) {
+        *target = MAKE_PTE(page, attribute);
+        return 0;
+    }
+
+    void *copy = kalloc();
+    if (copy == NULL) {
+        return -1;
+    }
+    memcpy(copy, page, PGSIZE);
+    *target = MAKE_PTE(copy, attribute);
+    // other threads may still read the shared page through TLB
+    mm_flush_tlb(mm);
+    kfree(page);
+    return 0;
+}
+
+// return a copy of region with its own references, NULL if out of memory
+static struct mm_region *copy_region(const struct mm_region *region)
+{
+    struct mm_region *copy = slab_alloc(&region_cache);
+    if (copy == NULL) {
+        return NULL;
+    }
+    *copy = *region;
+    if (copy->ip != NULL) {
+        idup(copy->ip);
+    }
+    if (copy->image != NULL) {
+        dup_exec_image(copy->image);
+    }
+    if (copy->shm != NULL) {
+        dup_shm(copy->shm);
+    }
+    return copy;
+}
+
+// add a copy of new to regions, which are sorted by start, see copy_region().
+// return -1 if it overlaps another one or out of memory
+int insert_region(struct list_head *regions, const struct mm_region *new)
+{
+    struct list_head *next = regions;
+    struct mm_region *region;
+    list_for_each_entry(region, regions, list) {
+        if (region->start >= new->end) {
+            next = &region->list;
+            break;
+        }
+        if (region->end > new->start) {
+            return -1;
+        }
+    }
+
+    region = copy_region(new);
+    if (region == NULL) {
+        return -1;
+    }
+    list_add_tail(&region->list, next);
+    return 0;
+}
+
+// copy regions of src to dst, which is empty. return -1 if out of memory,
+// what have been copied are left in dst
+int dup_regions(struct list_head *dst, struct list_head *src)
+{
+    struct mm_region *region;
+    list_for_each_entry(region, src, list) {
+        struct mm_region *copy = copy_region(region);
+        if (copy == NULL) {
+            return -1;
+        }
+        list_add_tail(&copy->list, dst);
+    }
+    return 0;
+}
+
+// free all regions, it sleeps to put their inodes
+void free_regions(struct list_head *regions)
+{
+    struct mm_region *region, *next;
+    list_for_each_entry_safe(region, next, regions, list) {
+        list_del(&region->list);
+        if (region->ip != NULL) {
+            begin_op();
+            iput(region->ip);
+            end_op();
+        }
+        if (region->image != NULL) {
+            put_exec_image(region->image);
+        }
+        if (region->shm != NULL) {
+            put_shm(region->shm);
+        }
+        slab_free(&region_cache, region);
+    }
+}
+
+// call with mm lock, swap regions of mm and regions. the old ones shall be
+// freed after mm lock is released
+void mm_set_regions(struct proc_mm *mm, struct list_head *regions)
+{
+    LIST_HEAD(old);
+    list_splice_init(&mm->regions, &old);
+    list_splice_init(regions, &mm->regions);
+    list_splice(&old, regions);
+    mm->regions_gen++;
+}
+
+// unmap and free pages of regions from pgtable, which no cpu runs with
+void free_region_pages(page_table pgtable, struct list_head *regions)
+{
+    struct mm_region *region;
+    list_for_each_entry(region, regions, list) {
+        unmap_n_pages_free_hole(pgtable, region->start,
+                                (region->end - region->start) / PGSIZE);
+    }
+}
+
+// call with mm lock, share pages of regions above heap to dst copy on write,
+// see share_page_table_in_interval(). pages of shm stay shared, dst maps them
+// on first touch
+int mm_share_regions(page_table dst, struct proc_mm *mm)
+{
+    struct mm_region *region;
+    list_for_each_entry(region, &mm->regions, list) {
+        if (region->start >= mm->mem_end && region->shm == NULL &&
+            share_page_table_in_interval(dst, mm->pgtable, region->start,
+                                         region->end)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// call with mm lock, return 1 if a region overlaps [start, end)
+int mm_regions_overlap(struct proc_mm *mm, uint64 start, uint64 end)
+{
+    struct mm_region *region;
+    list_for_each_entry(region, &mm->regions, list) {
+        if (region->start < end && region->end > start) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// call with mm lock, the highest free range of size above heap, 0 if there
+// is none
+static uint64 find_free_range(struct proc_mm *mm, uint64 size)
+{
+    uint64 top = PROC_VA_END;
+    struct mm_region *region;
+    list_for_each_entry_reverse(region, &mm->regions, list) {
+        if (region->end <= top && top - region->end >= size) {
+            break;
+        }
+        top = MIN(top, region->start);
+    }
+    if (top < size || top - size < mm->mem_end) {
+        return 0;
+    }
+    return top - size;
+}
+
+/*
+ * call with mm lock, add a copy of new with size bytes above heap, see
+ * insert_region(). return its start, -1 if there is no room or out of memory
+ */
+uint64 mm_map_region(struct proc_mm *mm, uint64 size, struct mm_region *new)
+{
+    new->start = find_free_range(mm, size);
+    new->end = new->start + size;
+    if (new->start == 0 || insert_region(&mm->regions, new)) {
+        return -1;
+    }
+    mm->regions_gen++;
+    return new->start;
+}
+
+// call with mm lock, make region start at va, dropping what is below
+static void trim_region_head(struct mm_region *region, uint64 va)
+{
+    uint64 cut = va - region->start;
+    region->file_off += cut;
+    region->file_size = region->file_size > cut ? region->file_size - cut : 0;
+    region->start = va;
+}
+
+/*
+ * call with mm lock, unmap regions in [start, end), and free their pages.
+ * regions left with nothing are moved to freed, which shall be freed after
+ * mm lock is released. return -1 if out of memory
+ */
+int mm_unmap_range(struct proc_mm *mm, uint64 start, uint64 end,
+                   struct list_head *freed)
+{
+    struct mm_region *region, *next;
+    list_for_each_entry_safe(region, next, &mm->regions, list) {
+        if (region->end <= start || region->start >= end) {
+            continue;
+        }
+        // a hole in the middle, the only region in range
+        if (region->start < start && region->end > end) {
+            struct mm_region *tail = copy_region(region);
+            if (tail == NULL) {
+                return -1;
+            }
+            trim_region_head(tail, end);
+            list_add(&tail->list, &region->list);
+            region->end = start;
+            mm_unmap_pages(mm, start, (end - start) / PGSIZE);
+            break;
+        }
+
+        uint64 va = MAX(region->start, start);
+        uint64 va_end = MIN(region->end, end);
+        mm_unmap_pages(mm, va, (va_end - va) / PGSIZE);
+        if (region->start < start) {
+            region->end = start;
+        } else if (region->end > end) {
+            trim_region_head(region, end);
+        } else {
+            list_move_tail(&region->list, freed);
+        }
+    }
+    mm->regions_gen++;
+    return 0;
+}
+
+// call with mm lock, return the region holding va, NULL if there is none
+struct mm_region *mm_find_region(struct proc_mm *mm, uint64 va)
+{
+    struct mm_region *region;
+    list_for_each_entry(region, &mm->regions, list) {
+        if (va < region->start) {
+            break;
+        }
+        if (va < region->end) {
+            return region;
+        }
+    }
+    return NULL;
+}
+
+// call with mm lock, map page at va, free page if it fails
+static int map_new_page(struct proc_mm *mm, uint64 va, void *page,
+                        uint64 attribute)
+{
+    if (map_page(mm->pgtable, va, (uint64)page, attribute)) {
+        kfree(page);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * call with mm lock, map the page at va of region read from its file, or the
+ * one cached in its image. mm lock is released while reading, if the page has
+ * been mapped or regions have changed meanwhile, return 0 to let the access
+ * try again.
+ */
+static int map_region_page(struct proc_mm *mm, struct mm_region *region,
+                           uint64 va, int can_sleep)
+{
+    uint64 off = va - region->start;
+    uint n = off < region->file_size ? MIN(PGSIZE, region->file_size - off) : 0;
+    uint file_off = region->file_off + off;
+    struct exec_image *image = region->image;
+    void *page;
+    if (region->shm != NULL) {
+        page = shm_page(region->shm, file_off / PGSIZE);
+        return page ? map_new_page(mm, va, page, region->attribute) : -1;
+    }
+    if (image != NULL &&
+        (page = exec_image_page(image, file_off / PGSIZE, n)) != NULL) {
+        return map_new_page(mm, va, page, region->attribute);
+    }
+    if (n == 0) {
+        page = get_clear_page();
+        return page ? map_new_page(mm, va, page, region->attribute) : -1;
+    }
+    if (can_sleep == 0) {
+        return -1;
+    }
+
+    struct inode *ip = idup(region->ip);
+    if (image != NULL) {
+        dup_exec_image(image);
+    }
+    uint64 attribute = region->attribute;
+    uint64 gen = mm->regions_gen;
+    release_spin_lock(&mm->lock);
+
+    int err = -1;
+    page = get_clear_page();
+    if (page != NULL) {
+        ilock(ip);
+        err = readi(ip, KPTR, (uint64)page, file_off, n) != n;
+        // the file can't change before it is cached
+        if (err == 0 && image != NULL) {
+            exec_image_add_page(image, file_off / PGSIZE, n, page);
+        }
+        iunlock(ip);
+    }
+    begin_op();
+    iput(ip);
+    end_op();
+    if (image != NULL) {
+        put_exec_image(image);
+    }
+
+    acquire_spin_lock(&mm->lock);
+    if (err) {
+        if (page != NULL) {
+            kfree(page);
+        }
+        return -1;
+    }
+    pte *target = walk(mm->pgtable, va, 0);
+    if (mm->regions_gen != gen || (target != NULL && (*target & PTE_V))) {
+        kfree(page);
+        return 0;
+    }
+    return map_new_page(mm, va, page, attribute);
+}
+
+// slot whose user stack can grow to va, -1 if there is none
+static int stack_slot_of(struct proc_mm *mm, uint64 va)
+{
+    if (va < PROC_VA_END || va >= TRAMPOLINE_BASE) {
+        return -1;
+    }
+    int slot = (TRAMPOLINE_BASE - 1 - va) / THREAD_SLOT_SIZE;
+    if ((mm->thread_slots & (1UL << slot)) == 0 || va < USTACK_LIMIT(slot) ||
+        va >= USTACK_VA(slot)) {
+        return -1;
+    }
+    return slot;
+}
+
+// call with mm lock, map a zeroed page at va if it is in heap or a stack.
+// pages there are allocated on first touch, see syscall/uvm.c
+static int map_zero_page(struct proc_mm *mm, uint64 va)
+{
+    uint64 attribute;
+    if (va >= mm->mem_start && va < mm->mem_end) {
+        attribute = PTE_R | PTE_W | PTE_X | PTE_U;
+    } else if (stack_slot_of(mm, va) != -1) {
+        attribute = PTE_R | PTE_W | PTE_U;
+    } else {
+        return -1;
+    }
+
+    void *page = get_clear_page();
+    if (page == NULL) {
+        return -1;
+    }
+    return map_new_page(mm, va, page, attribute);
+}
+
+/*
+ * call with mm lock, handle a fault when user accesses va. return 0 if user
+ * can access it now or shall try again, -1 if it is a bad access. another
+ * thread may have handled it before us. if can_sleep, mm lock may be released
+ * to read a page of region, otherwise such a fault is a bad access.
+ */
+int mm_handle_fault(struct proc_mm *mm, uint64 va, int access, int can_sleep)
+{
+    pte *target = walk(mm->pgtable, va, 0);
+    if (target == NULL || (*target & PTE_V) == 0) {
+        va = ROUND_DOWN_PGSIZE(va);
+        struct mm_region *region = mm_find_region(mm, va);
+        if (region != NULL) {
+            return map_region_page(mm, region, va, can_sleep);
+        }
+        return map_zero_page(mm, va);
+    }
+    if ((*target & PTE_U) == 0) {
+        return -1;
+    }
+
+    if (access == FAULT_WRITE) {
+        if (*target & PTE_W) {
+            return 0;
+        }
+        return (*target & PTE_COW) ? break_cow(mm, target) : -1;
+    }
+    uint64 need = access == FAULT_EXEC ? PTE_X : PTE_R;
+    return (*target & need) ? 0 : -1;
+}
+
+/*
+ * handle a fault for kernel copying to or from user memory of pgtable, which
+ * shall belong to my proc. pages of files are not read with intr off or in a
+ * fs op, which would wait for locks we may hold, see mm_prefault().
+ */
+int mm_fault_in(page_table pgtable, uint64 va, int access)
+{
+    struct process *proc = my_proc();
+    if (proc == NULL || proc->proc_pgtable != pgtable) {
+        return -1;
+    }
+
+    int can_sleep = intr_is_on() && proc->in_fs_op == 0;
+    struct proc_mm *mm = proc->mm;
+    acquire_spin_lock(&mm->lock);
+    int err = mm_handle_fault(mm, va, access, can_sleep);
+    release_spin_lock(&mm->lock);
+    return err;
+}
+
+// fault in user memory [va, va + n) of my proc before copying it with locks
+// held, bad pages are left for the copy to fail
+void mm_prefault(uint64 va, uint64 n, int access)
+{
+    page_table pgtable = my_proc()->proc_pgtable;
+    if (va + n < va) {
+        return;
+    }
+    for (uint64 a = ROUND_DOWN_PGSIZE(va); a < va + n; a += PGSIZE) {
+        if (mm_fault_in(pgtable, a, access)) {
+            return;
+        }
+    }
+}
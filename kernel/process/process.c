@@ -8,10 +8,15 @@
 #include "fs/param.h"
 #include "fs/stat.h"
 #include "lock/spin_lock.h"
+#include "process/exec_image.h"
 #include "process/proc_group.h"
+#include "process/proc_mm.h"
 #include "process/process_loader.h"
+#include "scheduler/sched_policy.h"
+#include "scheduler/scheduler.h"
 #include "riscv/vm_system.h"
 #include "scheduler/sleep.h"
+#include "scheduler/timer.h"
 #include "trap/intr_handler.h"
 #include "trap/introff.h"
 #include "trap/kernel_trap_jump.h"
@@ -22,58 +27,88 @@
 #include "vm/kalloc.h"
 #include "vm/kvm.h"
 #include "vm/memory_layout.h"
+#include "vm/slab.h"
 #include "vm/vm.h"
 
 int init_fs;
 
 // proc lock acquired in sequence: parent -> child -> childchild
-struct process proc_set[STATIC_PROC_NUM];
-
-char pid_set[STATIC_PROC_NUM];
+// procs are type stable, see vm/slab.h. a free proc is UNUSED
+struct slab_cache proc_cache;
+struct slab_cache files_cache;
+struct process *init_proc;
+
+/*
+ * pid_table[pid] is the proc with pid, NULL if pid is free. free pids are on a
+ * stack, a pid never used is poped only when all used ones are in use, so pids
+ * stay below the number of procs at peak. all protected by pid_lock
+ */
+struct process *pid_table[MAX_PROC_NUM];
+pid_t free_pids[MAX_PROC_NUM];
+int free_pids_top;
+int nr_procs;
 struct spin_lock pid_lock;
 
+static void proc_ctor(void *obj)
+{
+    struct process *proc = obj;
+    proc->pid = -1;
+    proc->status = UNUSED;
+    init_spin_lock(&proc->lock);
+    proc->pgroup_id = -1;
+    INIT_LIST_HEAD(&proc->run_list);
+    INIT_LIST_HEAD(&proc->wait_list);
+    INIT_LIST_HEAD(&proc->children);
+    INIT_LIST_HEAD(&proc->zombies);
+    INIT_LIST_HEAD(&proc->sibling);
+}
+
 void process_init(void)
 {
     init_spin_lock(&pid_lock);
+    // chain of a free proc is never read
+    init_slab_cache(&proc_cache, sizeof(struct process),
+                    offsetof(struct process, chain), proc_ctor);
+    init_slab_cache(&files_cache, sizeof(struct proc_files), 0, NULL);
+    proc_mm_init();
+    exec_image_init();
 
-    for (int i = 0; i < STATIC_PROC_NUM; i++) {
-        proc_set[i].pid = -1;
-        proc_set[i].status = UNUSED;
-        init_spin_lock(&proc_set[i].lock);
-        proc_set[i].pgroup_id = -1;
+    for (int i = 0; i < MAX_PROC_NUM; i++) {
+        free_pids[i] = MAX_PROC_NUM - 1 - i;
     }
+    free_pids_top = MAX_PROC_NUM;
 }
 
-static struct process *get_init_process(void) { return &proc_set[0]; }
-
-static int alloc_pid(void)
+static int alloc_pid(struct process *proc)
 {
-    int pid = -1;
     acquire_spin_lock(&pid_lock);
-    for (int i = 0; i < STATIC_PROC_NUM; i++) {
-        if (pid_set[i] == 0) {
-            pid_set[i] = 1;
-            pid = i;
-            break;
-        }
+    if (free_pids_top == 0) {
+        release_spin_lock(&pid_lock);
+        return -1;
     }
+    pid_t pid = free_pids[--free_pids_top];
+    pid_table[pid] = proc;
+    nr_procs++;
     release_spin_lock(&pid_lock);
 
     return pid;
 }
 
-static void free_pid(int i)
+static void free_pid(pid_t pid)
 {
     acquire_spin_lock(&pid_lock);
-    if (pid_set[i] == 0) {
+    if (pid_table[pid] == NULL) {
         PANIC_FN("try to free unused pid");
     }
-    pid_set[i] = 0;
+    pid_table[pid] = NULL;
+    free_pids[free_pids_top++] = pid;
+    nr_procs--;
     release_spin_lock(&pid_lock);
 }
 
 static void user_proc_entry(void)
 {
+    finish_proc_switch();
     release_spin_lock(&my_proc()->lock);
 
     if (init_fs == 0) {
@@ -84,7 +119,9 @@ static void user_proc_entry(void)
     user_trap_ret();
 }
 
-static int init_user_pagetable(struct process *proc, page_table pgtable)
+// map ustack and trap frame of proc to a slot of mm, see mm_map_thread_slot()
+static int init_user_pagetable(struct process *proc, struct proc_mm *mm,
+                               int slot)
 {
     void *trap_frame_page = kalloc();
     if (trap_frame_page == NULL) {
@@ -96,35 +133,38 @@ static int init_user_pagetable(struct process *proc, page_table pgtable)
         return -1;
     }
 
-    int err = map_page(pgtable, TRAMPOLINE_BASE,
-                       ROUND_DOWN_PGSIZE(user_trap_entry), PTE_R | PTE_X);
-    err |= map_page(pgtable, TRAPFRAME_BASE, (uint64)trap_frame_page,
-                    PTE_R | PTE_W);
-    err |=
-        map_page(pgtable, USTACK_BASE, (uint64)ustack, PTE_R | PTE_W | PTE_U);
-    if (err) {
+    slot = mm_map_thread_slot(mm, slot, ustack, trap_frame_page);
+    if (slot == -1) {
         kfree(trap_frame_page);
         kfree(ustack);
         return -1;
     }
 
+    proc->mm = mm;
+    proc->thread_slot = slot;
+    proc->proc_pgtable = mm->pgtable;
     proc->ustack = (uint64)ustack;
     proc->proc_trap_frame = trap_frame_page;
 
     return 0;
 }
 
-static int init_user_process(struct process *find_proc)
+// give proc a new mm if mm is NULL, or share mm with its other threads
+static int init_user_process(struct process *find_proc, struct proc_mm *mm,
+                             int slot)
 {
-    page_table pgtable = get_pagetable();
-    if (pgtable == NULL) {
-        return -1;
+    if (mm == NULL) {
+        mm = alloc_mm();
+        if (mm == NULL) {
+            return -1;
+        }
+    } else {
+        get_mm(mm);
     }
-    find_proc->proc_pgtable = pgtable;
 
-    int err = init_user_pagetable(find_proc, pgtable);
+    int err = init_user_pagetable(find_proc, mm, slot);
     if (err) {
-        free_page_table(find_proc->proc_pgtable);
+        put_mm(mm);
         return -1;
     }
 
@@ -134,7 +174,7 @@ static int init_user_process(struct process *find_proc)
     }
     find_proc->kstack = (uint64)kstack;
 
-    int pid = alloc_pid();
+    int pid = alloc_pid(find_proc);
     if (pid == -1) {
         kfree(kstack);
         goto err_ret;
@@ -146,6 +186,13 @@ static int init_user_process(struct process *find_proc)
     find_proc->xstatus = 0;
     find_proc->chain = NULL;
     find_proc->parent = NULL;
+    find_proc->files = NULL;
+    find_proc->in_fs_op = 0;
+    find_proc->last_cpu = -1;
+    find_proc->cpu_mask = CPU_MASK_ALL;
+    find_proc->on_rq = 0;
+    find_proc->nice = NICE_DEFAULT;
+    find_proc->vruntime = 0;
 
     // basic setup for trap frame
     find_proc->proc_trap_frame->kernel_trap_entry_ptr =
@@ -156,7 +203,7 @@ static int init_user_process(struct process *find_proc)
         (uint64)user_trap_handler;
     // fake return to user sapce
     find_proc->proc_trap_frame->sepc = PROC_VA_START;
-    find_proc->proc_trap_frame->sp = USTACK_BASE + PGSIZE;
+    find_proc->proc_trap_frame->sp = USTACK_VA(find_proc->thread_slot) + PGSIZE;
 
     // fake process context
     find_proc->proc_context.ra = (uint64)user_proc_entry;
@@ -165,37 +212,97 @@ static int init_user_process(struct process *find_proc)
     return 0;
 
 err_ret:
-    free_page_table(find_proc->proc_pgtable);
-    kfree((void *)find_proc->ustack);
-    kfree(find_proc->proc_trap_frame);
+    mm_unmap_thread_slot(mm, find_proc->thread_slot);
+    put_mm(mm);
     return -1;
 }
 
-static struct process *alloc_process(void)
+// see init_user_process()
+static struct process *alloc_process(struct proc_mm *mm, int slot)
 {
-    for (int i = 0; i < STATIC_PROC_NUM; i++) {
-        struct process *proc = &proc_set[i];
+    struct process *proc = slab_alloc(&proc_cache);
+    if (proc == NULL) {
+        return NULL;
+    }
 
-        acquire_spin_lock(&proc->lock);
-        if (proc->status != UNUSED) {
-            release_spin_lock(&proc->lock);
-            continue;
-        }
+    acquire_spin_lock(&proc->lock);
+    if (proc->status != UNUSED) {
+        PANIC_FN("alloc proc in use");
+    }
+    proc->status = USED;
+    release_spin_lock(&proc->lock);
 
-        proc->status = USED;
+    int err = init_user_process(proc, mm, slot);
+    if (err) {
+        acquire_spin_lock(&proc->lock);
+        proc->status = UNUSED;
         release_spin_lock(&proc->lock);
+        slab_free(&proc_cache, proc);
+        return NULL;
+    }
+    return proc;
+}
 
-        int err = init_user_process(proc);
-        if (err) {
-            acquire_spin_lock(&proc->lock);
-            proc->status = UNUSED;
-            release_spin_lock(&proc->lock);
-            return NULL;
+static struct proc_files *alloc_files(void)
+{
+    struct proc_files *files = slab_alloc(&files_cache);
+    if (files == NULL) {
+        return NULL;
+    }
+    memset(files->ofile, 0, sizeof(files->ofile));
+    files->cwd = NULL;
+    files->ref = 1;
+    init_spin_lock(&files->lock);
+    return files;
+}
+
+// copy of files for a forked proc, NULL if out of memory
+static struct proc_files *dup_files(struct proc_files *files)
+{
+    struct proc_files *new_files = alloc_files();
+    if (new_files == NULL) {
+        return NULL;
+    }
+
+    acquire_spin_lock(&files->lock);
+    for (int i = 0; i < NOFILE; i++) {
+        if (files->ofile[i]) {
+            new_files->ofile[i] = filedup(files->ofile[i]);
         }
-        return proc;
     }
+    new_files->cwd = idup(files->cwd);
+    release_spin_lock(&files->lock);
+    return new_files;
+}
 
-    return NULL;
+static void get_files(struct proc_files *files)
+{
+    acquire_spin_lock(&files->lock);
+    files->ref++;
+    release_spin_lock(&files->lock);
+}
+
+// close opened files and cwd with the last thread
+static void put_files(struct proc_files *files)
+{
+    acquire_spin_lock(&files->lock);
+    int ref = --files->ref;
+    release_spin_lock(&files->lock);
+    if (ref) {
+        return;
+    }
+
+    for (int i = 0; i < NOFILE; i++) {
+        if (files->ofile[i]) {
+            fileclose(files->ofile[i]);
+            files->ofile[i] = NULL;
+        }
+    }
+    begin_op();
+    iput(files->cwd);
+    end_op();
+    files->cwd = NULL;
+    slab_free(&files_cache, files);
 }
 
 static int fake_elf_read(struct inode *ip, int user_dst, uint64 dst, uint off,
@@ -210,53 +317,61 @@ static int fake_elf_read(struct inode *ip, int user_dst, uint64 dst, uint off,
 
 void setup_init_proc(void)
 {
-    struct process *proc = alloc_process();
+    struct process *proc = alloc_process(NULL, -1);
     if (proc == NULL) {
         PANIC_FN("fail to setup init process, process alloc error");
     }
+    proc->files = alloc_files();
+    if (proc->files == NULL) {
+        PANIC_FN("fail to setup init process, files alloc error");
+    }
 
-    uint64 mem_end = load_process_elf(proc->proc_pgtable, init_code_binary,
-                                      init_code_binary_size, fake_elf_read);
+    uint64 mem_end =
+        load_process_elf(proc->proc_pgtable, NULL, init_code_binary,
+                         init_code_binary_size, fake_elf_read);
     if (mem_end == -1) {
         PANIC_FN("fail to setup init process, elf load error");
     }
-    proc->status = RUNABLE;
-    proc->mem_start = mem_end;
-    proc->mem_brk = mem_end;
-    proc->mem_end = mem_end;
-    proc->cwd = namei("/");
+    proc->mm->mem_start = mem_end;
+    proc->mm->mem_brk = mem_end;
+    proc->mm->mem_end = mem_end;
+    proc->files->cwd = namei("/");
+    init_proc = proc;
 
     setup_default_proc_group(proc);
+    acquire_spin_lock(&proc->lock);
+    set_proc_runable(proc);
+    release_spin_lock(&proc->lock);
 }
 
+// pages never touched are not mapped, see mm_handle_fault()
 static void free_user_memory(page_table pgtable, uint64 mem_end)
 {
-    unmap_n_pages_free(pgtable, PROC_VA_START,
-                       (mem_end - PROC_VA_START) / PGSIZE);
+    unmap_n_pages_free_hole(pgtable, PROC_VA_START,
+                            (mem_end - PROC_VA_START) / PGSIZE);
 }
 
-static void free_process_user_memory(struct process *proc)
+// free user memory of proc, with mm if it is the last thread. it may sleep,
+// see put_mm()
+static void free_proc_mm(struct process *proc)
 {
-    free_user_memory(proc->proc_pgtable, proc->mem_end);
+    mm_unmap_thread_slot(proc->mm, proc->thread_slot);
+    put_mm(proc->mm);
+    proc->mm = NULL;
+    proc->proc_pgtable = NULL;
 }
 
 // call with proc locked
 // this function entirely free the process, make final free,
-// and set the proc to unused
+// and set the proc to unused. proc lock is released and proc is given back
 static void free_process(struct process *proc)
 {
-    // free user memory
     free_pid(proc->pid);
-    free_process_user_memory(proc);
-    kfree((void *)proc->ustack);
-    kfree(proc->proc_trap_frame);
-    free_page_table(proc->proc_pgtable);
 
-    // free kernel memory
+    // user memory was freed when exit, free kernel memory
     kfree((void *)proc->kstack);
 
-    // files and inode were freed when exit
-    // don't need to free here
+    // files were put when exit, don't need to free here
 
     // set other var to init status
     proc->pid = -1;
@@ -267,23 +382,75 @@ static void free_process(struct process *proc)
     proc->parent = NULL;
 
     proc->pgroup_id = -1;
+    release_spin_lock(&proc->lock);
+    slab_free(&proc_cache, proc);
+}
+
+// make fork_proc runable as a child of proc
+static pid_t start_child(struct process *proc, struct process *fork_proc)
+{
+    // parent's lock protects its children lists
+    acquire_spin_lock(&proc->lock);
+    fork_proc->parent = proc;
+    list_add_tail(&fork_proc->sibling, &proc->children);
+    release_spin_lock(&proc->lock);
+
+    // add to parent proc group
+    int err = forkproc_into_pgroup(proc->pgroup_id, fork_proc);
+    if (err) {
+        PANIC_FN("fail to add child to parent's proc group");
+    }
+
+    pid_t pid = fork_proc->pid;
+    acquire_spin_lock(&fork_proc->lock);
+    set_proc_runable(fork_proc);
+    release_spin_lock(&fork_proc->lock);
+
+    return pid;
 }
 
 uint64 fork(struct process *proc)
 {
-    struct process *fork_proc = alloc_process();
+    // the child takes the slot of the calling thread, its only thread
+    struct process *fork_proc = alloc_process(NULL, proc->thread_slot);
     if (fork_proc == NULL) {
         return -1;
     }
 
-    // map and copy [va_start, mem_end]
-    int err = merge_page_table_in_interval(fork_proc->proc_pgtable,
+    // pages not read yet are read by each on its own
+    struct proc_mm *mm = proc->mm;
+    acquire_spin_lock(&mm->lock);
+    int err = dup_regions(&fork_proc->mm->regions, &mm->regions);
+    // share [va_start, mem_end] copy on write, other threads may change it
+    if (err == 0) {
+        err = share_page_table_in_interval(fork_proc->proc_pgtable,
                                            proc->proc_pgtable, PROC_VA_START,
-                                           proc->mem_end);
-    if (err) {
+                                           mm->mem_end);
+    }
+    // and the pages our stack has grown, its first page is copied below
+    int slot = proc->thread_slot;
+    if (err == 0) {
+        err = share_page_table_in_interval(
+            fork_proc->proc_pgtable, proc->proc_pgtable, USTACK_LIMIT(slot),
+            USTACK_VA(slot));
+    }
+    // and the pages of mappings above heap
+    if (err == 0) {
+        err = mm_share_regions(fork_proc->proc_pgtable, mm);
+    }
+    // our other threads may still store to pages that become read only
+    mm_flush_tlb(mm);
+    fork_proc->mm->mem_start = mm->mem_start;
+    fork_proc->mm->mem_brk = mm->mem_brk;
+    fork_proc->mm->mem_end = mm->mem_end;
+    release_spin_lock(&mm->lock);
+    if (err == 0) {
+        fork_proc->files = dup_files(proc->files);
+    }
+    if (err || fork_proc->files == NULL) {
+        free_proc_mm(fork_proc);
         acquire_spin_lock(&fork_proc->lock);
         free_process(fork_proc);
-        release_spin_lock(&fork_proc->lock);
         return -1;
     }
     // copy user stack
@@ -297,31 +464,34 @@ uint64 fork(struct process *proc)
     fork_proc->proc_trap_frame->a0 = 0;
     fork_proc->proc_trap_frame->sepc = proc->proc_trap_frame->sepc;
 
-    fork_proc->parent = proc;
-    fork_proc->mem_start = proc->mem_start;
-    fork_proc->mem_brk = proc->mem_brk;
-    fork_proc->mem_end = proc->mem_end;
-
-    // dup user opened file and cwd
-    for (int i = 0; i < NOFILE; i++) {
-        if (proc->ofile[i]) {
-            fork_proc->ofile[i] = filedup(proc->ofile[i]);
-        }
-    }
-    fork_proc->cwd = idup(proc->cwd);
+    fork_proc->nice = proc->nice;
+    fork_proc->cpu_mask = proc->cpu_mask;
+    fork_proc->vruntime = proc->vruntime;
 
-    pid_t pid = fork_proc->pid;
-    acquire_spin_lock(&fork_proc->lock);
-    fork_proc->status = RUNABLE;
-    release_spin_lock(&fork_proc->lock);
+    return start_child(proc, fork_proc);
+}
 
-    // add to parent proc group
-    err = forkproc_into_pgroup(proc->pgroup_id, fork_proc);
-    if (err) {
-        PANIC_FN("fail to add child to parent's proc group");
+// start a thread sharing memory and files with proc, which runs fn(arg) on
+// its own user stack and returns to ret. it is a child of proc, joined by
+// wait()
+uint64 clone(struct process *proc, uint64 fn, uint64 arg, uint64 ret)
+{
+    struct process *thread = alloc_process(proc->mm, -1);
+    if (thread == NULL) {
+        return -1;
     }
+    get_files(proc->files);
+    thread->files = proc->files;
 
-    return pid;
+    thread->proc_trap_frame->sepc = fn;
+    thread->proc_trap_frame->a0 = arg;
+    thread->proc_trap_frame->ra = ret;
+    thread->proc_trap_frame->gp = proc->proc_trap_frame->gp;
+    thread->nice = proc->nice;
+    thread->cpu_mask = proc->cpu_mask;
+    thread->vruntime = proc->vruntime;
+
+    return start_child(proc, thread);
 }
 
 struct elf_in_kernel {
@@ -376,29 +546,35 @@ static int load_new_process_for_exec(struct process *proc, struct inode *elf,
         return -1;
     }
 
+    // segments are read on first touch, see struct mm_region
+    LIST_HEAD(regions);
     ilock(elf);
     if (elf->type != T_FILE) {
         iunlock(elf);
         kfree(new_pgtable);
         return -1;
     }
-    uint64 new_mem_end = load_process_elf(new_pgtable, elf, elf->size, readi);
+    uint64 new_mem_end =
+        load_process_elf(new_pgtable, &regions, elf, elf->size, readi);
     iunlock(elf);
     if (new_mem_end == -1) {
         free_page_table(new_pgtable);
+        free_regions(&regions);
         return -1;
     }
 
     // map allocated memory
+    int slot = proc->thread_slot;
     int err = map_page(new_pgtable, TRAMPOLINE_BASE,
                        ROUND_DOWN_PGSIZE(user_trap_entry), PTE_R | PTE_X);
-    err |= map_page(new_pgtable, TRAPFRAME_BASE, (uint64)proc->proc_trap_frame,
-                    PTE_R | PTE_W);
-    err |=
-        map_page(new_pgtable, USTACK_BASE, proc->ustack, PTE_R | PTE_W | PTE_U);
+    err |= map_page(new_pgtable, TRAPFRAME_VA(slot),
+                    (uint64)proc->proc_trap_frame, PTE_R | PTE_W);
+    err |= map_page(new_pgtable, USTACK_VA(slot), proc->ustack,
+                    PTE_R | PTE_W | PTE_U);
     if (err) {
         free_user_memory(new_pgtable, new_mem_end);
         free_page_table(new_pgtable);
+        free_regions(&regions);
         return -1;
     }
 
@@ -409,19 +585,30 @@ static int load_new_process_for_exec(struct process *proc, struct inode *elf,
         if (err) {
             free_user_memory(new_pgtable, new_mem_end);
             free_page_table(new_pgtable);
+            free_regions(&regions);
             return -1;
         }
         new_mem_end += PGSIZE;
     }
 
-    page_table old_pgtable = proc->proc_pgtable;
-    free_user_memory(old_pgtable, proc->mem_end);
+    // we are the only thread, no cpu runs with the old one
+    struct proc_mm *mm = proc->mm;
+    acquire_spin_lock(&mm->lock);
+    page_table old_pgtable = mm->pgtable;
+    free_user_memory(old_pgtable, mm->mem_end);
+    free_region_pages(old_pgtable, &mm->regions);
+    unmap_n_pages_free_hole(old_pgtable, USTACK_LIMIT(slot),
+                            USTACK_MAX_PAGES - 1);
     free_page_table(old_pgtable);
 
+    mm->pgtable = new_pgtable;
+    mm->mem_start = new_mem_end;
+    mm->mem_brk = new_mem_end;
+    mm->mem_end = new_mem_end;
+    mm_set_regions(mm, &regions);
+    release_spin_lock(&mm->lock);
     proc->proc_pgtable = new_pgtable;
-    proc->mem_start = new_mem_end;
-    proc->mem_brk = new_mem_end;
-    proc->mem_end = new_mem_end;
+    free_regions(&regions);
 
     return 0;
 }
@@ -429,6 +616,11 @@ static int load_new_process_for_exec(struct process *proc, struct inode *elf,
 uint64 exec(struct process *proc, char *file, int argc, char *argv[],
             char str_in_argv[])
 {
+    // other threads run in the memory we would replace
+    if (READ_ONCE(proc->mm->ref) > 1) {
+        return -1;
+    }
+
     // load proc elf from fs
     struct inode *elf_inode = namei(file);
     if (elf_inode == NULL) {
@@ -462,30 +654,36 @@ uint64 exec(struct process *proc, char *file, int argc, char *argv[],
     // set argc, argv and regs
     uint64 *proc_arg0 = &proc->proc_trap_frame->a0;
     proc_arg0[0] = argc;
-    proc_arg0[1] = proc->mem_end - PGSIZE;
-    proc->proc_trap_frame->sp = USTACK_BASE + PGSIZE;
+    proc_arg0[1] = proc->mm->mem_end - PGSIZE;
+    proc->proc_trap_frame->sp = USTACK_VA(proc->thread_slot) + PGSIZE;
     proc->proc_trap_frame->sepc = PROC_VA_START;
 
     return 0;
 }
 
+// call with init proc's lock and parent's lock, give parent's children to init
 static void reparent_children(struct process *parent)
 {
-    for (int i = 0; i < STATIC_PROC_NUM; i++) {
-        struct process *proc = &proc_set[i];
-        if (proc->parent == parent) {
-            acquire_spin_lock(&proc->lock);
-            proc->parent = &proc_set[0];
-            release_spin_lock(&proc->lock);
-        }
-    }
+    struct process *child;
+    list_for_each_entry(child, &parent->children, sibling) {
+        acquire_spin_lock(&child->lock);
+        child->parent = init_proc;
+        release_spin_lock(&child->lock);
+    }
+    list_for_each_entry(child, &parent->zombies, sibling) {
+        acquire_spin_lock(&child->lock);
+        child->parent = init_proc;
+        release_spin_lock(&child->lock);
+    }
+    list_splice_tail_init(&parent->children, &init_proc->children);
+    list_splice_tail_init(&parent->zombies, &init_proc->zombies);
 }
 
+// parent waits for children in wait(), sleeping on NULL chain
 static void wake_up_parent(struct process *parent)
 {
-    if (parent->status == SLEEP) {
-        parent->status = RUNABLE;
-        parent->chain = NULL;
+    if (parent->status == SLEEP && parent->chain == NULL) {
+        set_proc_runable(parent);
     }
 }
 
@@ -498,27 +696,20 @@ __attribute__((noreturn)) uint64 exit(struct process *proc, uint64 xstatus)
         PANIC_FN("init proc exit");
     }
 
-    // free opened files and cwd
-    for (int i = 0; i < NOFILE; i++) {
-        if (proc->ofile[i]) {
-            fileclose(proc->ofile[i]);
-            proc->ofile[i] = NULL;
-        }
-    }
-    begin_op();
-    iput(proc->cwd);
-    end_op();
-    proc->cwd = NULL;
+    // free opened files and cwd if no other thread uses them
+    put_files(proc->files);
+    proc->files = NULL;
+    // before we hold any lock, it may sleep
+    free_proc_mm(proc);
 
     // reparent
-    acquire_spin_lock(&proc_set[0].lock);
+    acquire_spin_lock(&init_proc->lock);
     acquire_spin_lock(&proc->lock);
 
     reparent_children(proc);
-    wake_up_parent(&proc_set[0]);
-    struct process *parent = proc->parent;
+    wake_up_parent(init_proc);
 
-    release_spin_lock(&proc_set[0].lock);
+    release_spin_lock(&init_proc->lock);
     release_spin_lock(&proc->lock);
 
     // we will exit proc group, close intr to avoid proc lost
@@ -526,30 +717,26 @@ __attribute__((noreturn)) uint64 exit(struct process *proc, uint64 xstatus)
 
     exit_pgroup();
 
-    // ZOMBIE current proc
-    acquire_spin_lock(&parent->lock);
-    acquire_spin_lock(&proc->lock);
-
-    if (proc->parent == parent) {
-        wake_up_parent(proc->parent);
-        release_spin_lock(&parent->lock);
-    } else {
-        if (proc->parent != &proc_set[0]) {
-            PANIC_FN("reparent proc to other proc(not proc 0)");
+    // ZOMBIE current proc. parent may exit and give us to init before we get
+    // its lock, try again with the new one
+    struct process *parent;
+    while (1) {
+        parent = READ_ONCE(proc->parent);
+        acquire_spin_lock(&parent->lock);
+        acquire_spin_lock(&proc->lock);
+        if (proc->parent == parent) {
+            break;
         }
-
         release_spin_lock(&parent->lock);
         release_spin_lock(&proc->lock);
-
-        acquire_spin_lock(&proc_set[0].lock);
-        acquire_spin_lock(&proc->lock);
-        wake_up_parent(&proc_set[0]);
-        release_spin_lock(&proc_set[0].lock);
     }
 
+    list_move_tail(&proc->sibling, &parent->zombies);
     proc->status = ZOMBIE;
     proc->xstatus = xstatus;
     proc->chain = NULL;
+    wake_up_parent(parent);
+    release_spin_lock(&parent->lock);
     pop_introff();
 
     // proc->status has been setted
@@ -561,44 +748,44 @@ __attribute__((noreturn)) uint64 exit(struct process *proc, uint64 xstatus)
     PANIC_FN("ZOMBIE proc returned");
 }
 
-// call with proc lock
+// call with proc lock, reap a ZOMBIE child. return 1 if proc has no child
 static int handle_exit_child(struct process *proc, uint64 int_uva, pid_t *pid)
 {
     *pid = -1;
-    int no_child_err = 1;
-    for (int i = 0; i < STATIC_PROC_NUM; i++) {
-        struct process *other_proc = &proc_set[i];
-        if (other_proc->parent != proc) {
-            continue;
-        }
-
-        no_child_err = 0;
-
-        acquire_spin_lock(&other_proc->lock);
-        if (other_proc->status != ZOMBIE) {
-            release_spin_lock(&other_proc->lock);
-            continue;
-        }
-
-        *pid = other_proc->pid;
-        if ((char *)int_uva != NULL) {
-            int err = copy_out(proc->proc_pgtable, int_uva,
-                               &other_proc->xstatus, sizeof(int));
-            if (err) {
-                release_spin_lock(&other_proc->lock);
-                return -1;
-            }
-        }
-        free_process(other_proc);
-        release_spin_lock(&other_proc->lock);
+    if (list_empty(&proc->children) && list_empty(&proc->zombies)) {
+        return 1;
+    }
+    struct process *child =
+        list_first_entry_or_null(&proc->zombies, struct process, sibling);
+    if (child == NULL) {
         return 0;
     }
 
-    return no_child_err;
+    // child may be still switching out, wait for it
+    acquire_spin_lock(&child->lock);
+    if (child->status != ZOMBIE) {
+        PANIC_FN("not ZOMBIE child in zombies");
+    }
+    if ((char *)int_uva != NULL) {
+        int err = copy_out(proc->proc_pgtable, int_uva, &child->xstatus,
+                           sizeof(int));
+        if (err) {
+            release_spin_lock(&child->lock);
+            return -1;
+        }
+    }
+    *pid = child->pid;
+    list_del_init(&child->sibling);
+    free_process(child);
+    return 0;
 }
 
 uint64 wait(struct process *proc, uint64 int_uva)
 {
+    // xstatus is copied with proc lock, see mm_fault_in()
+    if ((char *)int_uva != NULL) {
+        mm_prefault(int_uva, sizeof(int), FAULT_WRITE);
+    }
     acquire_spin_lock(&proc->lock);
 
     pid_t pid;
@@ -627,20 +814,31 @@ uint64 wait(struct process *proc, uint64 int_uva)
     }
 }
 
-uint64 kill(pid_t pid)
+// return the proc with pid and its lock, NULL if there is none
+struct process *get_proc_with_lock(pid_t pid)
 {
-    struct process *target = NULL;
-    for (int i = 0; i < STATIC_PROC_NUM; i++) {
-        struct process *proc = &proc_set[i];
+    if (pid < 0 || pid >= MAX_PROC_NUM) {
+        return NULL;
+    }
+    acquire_spin_lock(&pid_lock);
+    struct process *proc = pid_table[pid];
+    release_spin_lock(&pid_lock);
+    if (proc == NULL) {
+        return NULL;
+    }
 
-        acquire_spin_lock(&proc->lock);
-        if (proc->status == USED || proc->pid != pid) {
-            release_spin_lock(&proc->lock);
-            continue;
-        }
-        target = proc;
-        break;
+    // proc may be freed after we looked, it is still a proc, see vm/slab.h
+    acquire_spin_lock(&proc->lock);
+    if (proc->status == UNUSED || proc->status == USED || proc->pid != pid) {
+        release_spin_lock(&proc->lock);
+        return NULL;
     }
+    return proc;
+}
+
+uint64 kill(pid_t pid)
+{
+    struct process *target = get_proc_with_lock(pid);
     if (target == NULL) {
         return -1;
     }
@@ -648,71 +846,17 @@ uint64 kill(pid_t pid)
     target->killed = 1;
     release_spin_lock(&target->lock);
 
+    // wake it up if it is in sleep(), see timer_sleep()
+    wake_up(target);
     return 0;
 }
 
 uint64 proc_sys_sleep(int sleep_ticks)
 {
-    acquire(&tick_lock);
-    uint start_ticks = tick_count;
-    while (tick_count - start_ticks < sleep_ticks) {
-        if (myproc()->killed) {
-            release(&tick_lock);
-            return -1;
-        }
-        sleep(&tick_lock, &tick_count);
-    }
-    release(&tick_lock);
-    return 0;
-}
-
-static void lock_rest_process(char *locked)
-{
-    for (int i = 0; i < STATIC_PROC_NUM; i++) {
-        if (locked[i] == 0) {
-            acquire_spin_lock(&proc_set[i].lock);
-        }
-    }
-}
-
-static void lock_all_process_aux(struct process *proc, int pi, char *locked)
-{
-    locked[pi] = 1;
-    acquire_spin_lock(&proc->lock);
-    for (int i = 0; i < STATIC_PROC_NUM; i++) {
-        struct process *child = &proc_set[i];
-        if (child->parent == proc) {
-            lock_all_process_aux(child, i, locked);
-        }
-    }
-}
-
-static void lock_all_process(void)
-{
-    char locked[STATIC_PROC_NUM];
-    memset(locked, 0, sizeof(locked));
-
-    lock_all_process_aux(get_init_process(), 0, locked);
-    lock_rest_process(locked);
-}
-
-static void release_all_process(void)
-{
-    for (int i = 0; i < STATIC_PROC_NUM; i++) {
-        release_spin_lock(&proc_set[i].lock);
+    if (sleep_ticks <= 0) {
+        return 0;
     }
+    return timer_sleep(sleep_ticks);
 }
 
-uint64 count_proc_num(void)
-{
-    lock_all_process();
-    int n = 0;
-    for (int i = 0; i < STATIC_PROC_NUM; i++) {
-        if (proc_set[i].status != UNUSED) {
-            n++;
-        }
-    }
-    release_all_process();
-
-    return n;
-}
+uint64 count_proc_num(void) { return READ_ONCE(nr_procs); }
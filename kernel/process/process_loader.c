@@ -2,6 +2,8 @@
 #include "fs/defs.h"
 #include "fs/file.h"
 #include "process/elf.h"
+#include "process/exec_image.h"
+#include "process/proc_mm.h"
 #include "riscv/vm_system.h"
 #include "vm/kalloc.h"
 #include "vm/memory_layout.h"
@@ -47,7 +49,7 @@ int check_segment(struct Elf64_Phdr *segment, Elf64_Word file_size)
     if (segment->p_vaddr % PGSIZE || segment->p_vaddr < PROC_VA_START) {
         return -1;
     }
-    if (segment->p_vaddr + segment->p_memsz > USTACK_BASE) {
+    if (segment->p_vaddr + segment->p_memsz > PROC_VA_END) {
         return -1;
     }
     if (segment->p_offset + segment->p_filesz > file_size) {
@@ -63,11 +65,14 @@ int check_segment(struct Elf64_Phdr *segment, Elf64_Word file_size)
 uint64 get_attribute_from_p_flages(Elf64_Word p_flages)
 {
     uint64 attribute = PTE_U;
-    if ((p_flages & PF_X) || (p_flages & PTE_R)) {
-        attribute |= PTE_R | PTE_X;
+    if (p_flages & (PF_R | PF_X)) {
+        attribute |= PTE_R;
     }
-    if (p_flages & PTE_W) {
-        attribute |= PTE_R | PTE_W | PTE_X;
+    if (p_flages & PF_X) {
+        attribute |= PTE_X;
+    }
+    if (p_flages & PF_W) {
+        attribute |= PTE_R | PTE_W;
     }
 
     return attribute;
@@ -157,9 +162,38 @@ err_ret:
     return -1;
 }
 
-// call with inode lock
-uint64 load_process_elf(page_table pgtable, void *elf_file,
-                        Elf64_Word file_size, elf_read_fn_t elf_read)
+// record a region of segment in regions, see struct mm_region. read only
+// pages are shared by procs running elf_file, see struct exec_image
+static int add_region_for_segment(struct list_head *regions,
+                                  struct Elf64_Phdr *segment,
+                                  struct inode *elf_file)
+{
+    struct mm_region new = {
+        .start = segment->p_vaddr,
+        .end = segment->p_vaddr + ROUND_UP_PGSIZE(segment->p_memsz),
+        .attribute = get_attribute_from_p_flages(segment->p_flags),
+        .ip = elf_file,
+        .file_off = segment->p_offset,
+        .file_size = segment->p_filesz,
+    };
+    if ((new.attribute & PTE_W) == 0 && segment->p_offset % PGSIZE == 0) {
+        new.image = get_exec_image(elf_file);
+    }
+    int err = insert_region(regions, &new);
+    if (new.image != NULL) {
+        put_exec_image(new.image);
+    }
+    return err;
+}
+
+/*
+ * call with inode lock, map segments of elf_file to pgtable. if regions is not
+ * NULL, segments are added to it to be read on first touch instead, and the
+ * caller frees regions if it fails. return the end of segments
+ */
+uint64 load_process_elf(page_table pgtable, struct list_head *regions,
+                        void *elf_file, Elf64_Word file_size,
+                        elf_read_fn_t elf_read)
 {
     struct Elf64_Ehdr elf_header_mem;
     int err = read_check(elf_read, elf_file, KPTR, (uint64)&elf_header_mem, 0,
@@ -197,7 +231,12 @@ uint64 load_process_elf(page_table pgtable, void *elf_file,
             goto err_ret;
         }
 
-        err = map_segment_for_segment(pgtable, segment, elf_file, elf_read);
+        if (regions != NULL) {
+            err = add_region_for_segment(regions, segment, elf_file);
+        } else {
+            err = map_segment_for_segment(pgtable, segment, elf_file,
+                                          elf_read);
+        }
         if (err) {
             goto err_ret;
         }
@@ -209,6 +248,8 @@ uint64 load_process_elf(page_table pgtable, void *elf_file,
     return ROUND_UP_PGSIZE(mem_end);
 
 err_ret:
-    unmap_n_pages_free_hole(pgtable, PROC_VA_START, mem_end);
+    unmap_n_pages_free_hole(pgtable, PROC_VA_START,
+                            (ROUND_UP_PGSIZE(mem_end) - PROC_VA_START) /
+                                PGSIZE);
     return -1;
 }
@@ -0,0 +1,178 @@
+#include "scheduler/run_queue.h"
+#include "lock/spin_lock.h"
+#include "process/process.h"
+#include "scheduler/sched_policy.h"
+#include "util/kprint.h"
+#include "util/list.h"
+#include "util/skew_heap.h"
+
+void init_run_queue(struct run_queue *rq, int pgroup_id, int policy)
+{
+    INIT_LIST_HEAD(&rq->head);
+    rq->fair = NULL;
+    INIT_LIST_HEAD(&rq->pinned);
+    rq->nr = 0;
+    rq->fair_seq = 0;
+    rq->pgroup_id = pgroup_id;
+    rq->policy = policy;
+    init_spin_lock(&rq->lock);
+}
+
+// racy check without lock
+int run_queue_can_steal(struct run_queue *rq)
+{
+    return list_empty(&rq->head) == 0 || READ_ONCE(rq->fair) != NULL;
+}
+
+// racy check without lock
+int run_queue_empty(struct run_queue *rq)
+{
+    return run_queue_can_steal(rq) == 0 && list_empty(&rq->pinned);
+}
+
+// racy read without lock
+int run_queue_len(struct run_queue *rq) { return READ_ONCE(rq->nr); }
+
+static int do_push(struct run_queue *rq, struct process *proc, int pinned)
+{
+    acquire_spin_lock(&rq->lock);
+    if (rq->pgroup_id != proc->pgroup_id) {
+        release_spin_lock(&rq->lock);
+        return -1;
+    }
+    if (proc->on_rq) {
+        PANIC_FN("push proc that has been in run queue");
+    }
+    proc->on_rq = 1;
+    rq->nr++;
+    if (pinned) {
+        list_add_tail(&proc->run_list, &rq->pinned);
+    } else if (rq->policy == SCHED_FAIR) {
+        proc->fair_node.key = proc->vruntime;
+        proc->fair_node.seq = rq->fair_seq++;
+        skew_heap_push(&rq->fair, &proc->fair_node);
+    } else {
+        list_add_tail(&proc->run_list, &rq->head);
+    }
+    release_spin_lock(&rq->lock);
+    return 0;
+}
+
+// call with proc lock, return -1 if the run queue don't accept proc's group
+int run_queue_push(struct run_queue *rq, struct process *proc)
+{
+    return do_push(rq, proc, 0);
+}
+
+// same as run_queue_push(), proc is only poped by run_queue_pop()
+int run_queue_push_pinned(struct run_queue *rq, struct process *proc)
+{
+    return do_push(rq, proc, 1);
+}
+
+// call with run queue lock
+static struct process *pop_list(struct run_queue *rq, struct list_head *head)
+{
+    struct process *proc =
+        list_first_entry_or_null(head, struct process, run_list);
+    if (proc != NULL) {
+        list_del_init(&proc->run_list);
+    }
+    return proc;
+}
+
+// call with run queue lock
+static struct process *pop_locked(struct run_queue *rq, int with_pinned)
+{
+    struct process *proc = NULL;
+    struct skew_node *node;
+    if (with_pinned) {
+        proc = pop_list(rq, &rq->pinned);
+    }
+    if (proc == NULL && (node = skew_heap_pop(&rq->fair)) != NULL) {
+        proc = skew_heap_entry(node, struct process, fair_node);
+    }
+    if (proc == NULL) {
+        proc = pop_list(rq, &rq->head);
+    }
+    if (proc == NULL) {
+        return NULL;
+    }
+    proc->on_rq = 0;
+    rq->nr--;
+    return proc;
+}
+
+static struct process *do_pop(struct run_queue *rq, int pgroup_id,
+                              int with_pinned)
+{
+    acquire_spin_lock(&rq->lock);
+    if (rq->pgroup_id != pgroup_id) {
+        release_spin_lock(&rq->lock);
+        return NULL;
+    }
+    struct process *proc = pop_locked(rq, with_pinned);
+    release_spin_lock(&rq->lock);
+    return proc;
+}
+
+// return the first proc in queue, pinned ones first, NULL if empty or the run
+// queue is not for pgroup_id's group. proc lock is not acquired
+struct process *run_queue_pop(struct run_queue *rq, int pgroup_id)
+{
+    return do_pop(rq, pgroup_id, 1);
+}
+
+// same as run_queue_pop(), but leave pinned procs to the owner
+struct process *run_queue_steal(struct run_queue *rq, int pgroup_id)
+{
+    return do_pop(rq, pgroup_id, 0);
+}
+
+void run_queue_open(struct run_queue *rq, int pgroup_id, int policy)
+{
+    acquire_spin_lock(&rq->lock);
+    if (rq->pgroup_id != -1 || run_queue_empty(rq) == 0) {
+        PANIC_FN("open run queue that is in use");
+    }
+    rq->pgroup_id = pgroup_id;
+    rq->policy = policy;
+    release_spin_lock(&rq->lock);
+}
+
+// procs pushed from now on are queued by policy
+void run_queue_set_policy(struct run_queue *rq, int policy)
+{
+    acquire_spin_lock(&rq->lock);
+    rq->policy = policy;
+    release_spin_lock(&rq->lock);
+}
+
+// stop accepting procs, move procs left in queue to left, which is a run queue
+// only the caller can see
+void run_queue_close(struct run_queue *rq, struct run_queue *left)
+{
+    acquire_spin_lock(&rq->lock);
+    rq->pgroup_id = -1;
+    list_splice_tail_init(&rq->pinned, &left->pinned);
+    list_splice_tail_init(&rq->head, &left->head);
+    left->fair = skew_heap_merge(left->fair, rq->fair);
+    rq->fair = NULL;
+    left->nr += rq->nr;
+    rq->nr = 0;
+    release_spin_lock(&rq->lock);
+}
+
+// move procs to the queue, they shall belong to the queue's group. procs is a
+// run queue only the caller can see
+void run_queue_splice(struct run_queue *rq, struct run_queue *procs)
+{
+    acquire_spin_lock(&rq->lock);
+    list_splice_tail_init(&procs->pinned, &rq->pinned);
+    list_splice_tail_init(&procs->head, &rq->head);
+    rq->fair = skew_heap_merge(rq->fair, procs->fair);
+    procs->fair = NULL;
+    rq->nr += procs->nr;
+    procs->nr = 0;
+    release_spin_lock(&rq->lock);
+}
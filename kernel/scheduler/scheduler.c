@@ -2,64 +2,546 @@
 #include "config/basic_config.h"
 #include "cpus.h"
 #include "lock/spin_lock.h"
+#include "process/cpu_message.h"
 #include "process/proc_group.h"
 #include "process/process.h"
+#include "riscv/clint.h"
 #include "riscv/regs.h"
+#include "scheduler/run_queue.h"
+#include "scheduler/sched_policy.h"
 #include "scheduler/swtch.h"
+#include "scheduler/timer.h"
+#include "trap/intr_handler.h"
 #include "trap/introff.h"
+#include "util/cpumask.h"
 #include "util/kprint.h"
 #include "util/list.h"
 
-static struct process *get_runnable_proc_with_lock(struct proc_group *pgroup)
+// weight of nice NICE_MIN ~ NICE_MAX, a nice step is about 10% of cpu time
+static const uint32 nice_to_weight[NICE_MAX - NICE_MIN + 1] = {
+    88761, 71755, 56483, 46273, 36291, 29154, 23254, 18705, 14949, 11916,
+    9548,  7620,  6100,  4904,  3906,  3121,  2501,  1991,  1586,  1277,
+    1024,  820,   655,   526,   423,   335,   272,   215,   172,   137,
+    110,   87,    70,    56,    45,    36,    29,    23,    18,    15,
+};
+#define NICE_0_WEIGHT 1024
+
+// call with proc lock, charge proc for the time it runs since exec_start
+static void update_vruntime(struct process *proc)
+{
+    uint64 now = READ_REG(CLINT_MTIME);
+    uint64 delta = now - proc->exec_start;
+    proc->vruntime +=
+        delta * NICE_0_WEIGHT / nice_to_weight[proc->nice - NICE_MIN];
+    proc->exec_start = now;
+}
+
+// call with proc lock. a proc slept for long has small vruntime, only give it
+// a tick of credit so it won't take cpu until it catches up
+static void place_proc(struct proc_group *pgroup, struct process *proc)
 {
-    struct process *proc;
-    list_for_each_entry(proc, &pgroup->procs_head, pgroup_list)
-    {
-        acquire_spin_lock(&proc->lock);
-        if (proc->status == RUNABLE) {
-            return proc;
+    uint64 min = __atomic_load_n(&pgroup->min_vruntime, __ATOMIC_RELAXED);
+    if (min > TIME_TRAP_INTERVAL && proc->vruntime < min - TIME_TRAP_INTERVAL) {
+        proc->vruntime = min - TIME_TRAP_INTERVAL;
+    }
+}
+
+// proc is picked to run, min_vruntime follows it
+static void advance_min_vruntime(struct proc_group *pgroup,
+                                 struct process *proc)
+{
+    uint64 min = __atomic_load_n(&pgroup->min_vruntime, __ATOMIC_RELAXED);
+    while (min < proc->vruntime &&
+           __atomic_compare_exchange_n(&pgroup->min_vruntime, &min,
+                                       proc->vruntime, 0, __ATOMIC_RELAXED,
+                                       __ATOMIC_RELAXED) == 0) {
+    }
+}
+
+// set nice of current proc, return -1 if nice is out of range
+int set_my_nice(int nice)
+{
+    if (nice < NICE_MIN || nice > NICE_MAX) {
+        return -1;
+    }
+    struct process *proc = my_proc();
+    acquire_spin_lock(&proc->lock);
+    update_vruntime(proc);
+    proc->nice = nice;
+    release_spin_lock(&proc->lock);
+    return 0;
+}
+
+// return 0 if the cpu is idle and we are the one to kick it
+int claim_idle_cpu(struct cpu *c)
+{
+    int idle = 1;
+    if (__atomic_compare_exchange_n(&c->idle, &idle, 0, 0, __ATOMIC_SEQ_CST,
+                                    __ATOMIC_SEQ_CST)) {
+        return 0;
+    }
+    return -1;
+}
+
+// claim an idle cpu of mask in pgroup, try prefer first, NULL if there is none.
+// cpus may change without lock, a claimed cpu may have left the group, kick it
+// anyway so it won't miss work of its new group
+struct cpu *claim_idle_cpu_in_pgroup(struct proc_group *pgroup, int prefer,
+                                     cpumask_t mask)
+{
+    __sync_synchronize();
+    mask &= READ_ONCE(pgroup->cpus);
+    if (prefer != -1 && cpumask_test(mask, prefer) &&
+        claim_idle_cpu(&cpus[prefer]) == 0) {
+        return &cpus[prefer];
+    }
+    int i;
+    for_each_cpu(i, mask) {
+        if (claim_idle_cpu(&cpus[i]) == 0) {
+            return &cpus[i];
         }
-        release_spin_lock(&proc->lock);
     }
     return NULL;
 }
 
-static int run_process(void)
+// new work in pgroup, kick one of its idle cpus, or all of them. return the
+// number of cpus kicked
+int kick_idle_cpus(struct proc_group *pgroup, int all)
 {
-    struct cpu *mycpu = my_cpu_unsafe();
-    if (mycpu->pgroup_id == DEFAULT_PGROUP_ID) {
-        handle_cpu_acquire(); // mycpu->pgroup_id may change here
+    struct cpu *c;
+    int n = 0;
+    while ((c = claim_idle_cpu_in_pgroup(pgroup, -1, CPUMASK_POSSIBLE)) !=
+           NULL) {
+        kick_cpu(c->cpu_id);
+        n++;
+        if (all == 0) {
+            break;
+        }
     }
+    return n;
+}
 
-    struct proc_group *pgroup = get_proc_group(mycpu->pgroup_id);
+// cpu of a group can run default group's procs, see run_process()
+static int cpu_can_lend(struct cpu *c)
+{
+    int id = READ_ONCE(c->pgroup_id);
+    return id != -1 && id != DEFAULT_PGROUP_ID &&
+           get_proc_group(id)->exclusively_occupy == 0;
+}
+
+// default group has work no free cpu takes, kick an idle cpu of other group
+static void kick_idle_lender(void)
+{
+    int i;
+    cpumask_t others =
+        CPUMASK_POSSIBLE & ~READ_ONCE(get_proc_group(DEFAULT_PGROUP_ID)->cpus);
+    for_each_cpu(i, others) {
+        if (cpu_can_lend(&cpus[i]) && claim_idle_cpu(&cpus[i]) == 0) {
+            kick_cpu(i);
+            return;
+        }
+    }
+}
+
+// pgroup has work, take back a cpu it lent to default group
+static void reclaim_lent_cpu(struct proc_group *pgroup)
+{
+    int i;
+    for_each_cpu(i, READ_ONCE(pgroup->cpus)) {
+        if (READ_ONCE(cpus[i].lent)) {
+            kick_cpu(i);
+            return;
+        }
+    }
+}
+
+// call with proc lock, return cpus of pgroup proc can run on, CPU_MASK_ALL if
+// it can run on all of them. cpus may change without lock, it is only a hint,
+// procs are checked again when poped, see check_proc_cpu()
+static cpumask_t proc_allowed_cpus(struct process *proc,
+                                   struct proc_group *pgroup)
+{
+    cpumask_t group_mask = READ_ONCE(pgroup->cpus);
+    cpumask_t allowed = proc->cpu_mask & group_mask;
+    if (allowed == 0 || allowed == group_mask) {
+        return CPU_MASK_ALL;
+    }
+    return allowed;
+}
+
+// call with proc lock, pinned proc is left for cpu c, others can be stolen
+static int push_to_cpu(struct cpu *c, struct process *proc, cpumask_t allowed)
+{
+    if (allowed == CPU_MASK_ALL) {
+        return run_queue_push(&c->rq, proc);
+    }
+    return run_queue_push_pinned(&c->rq, proc);
+}
+
+/*
+ * call with RUNABLE proc's lock.
+ * place proc on an idle cpu it can run on and kick it, preferring the cpu last
+ * ran it. if no cpu is idle, place it on waker's cpu, or the cpu last ran it,
+ * if proc can run on the cpu. a pinned proc goes to any cpu it can run on.
+ * otherwise place it on group's shared run queue.
+ */
+static void queue_proc(struct proc_group *pgroup, struct process *proc)
+{
+    cpumask_t allowed = proc_allowed_cpus(proc, pgroup);
+    struct cpu *idle =
+        claim_idle_cpu_in_pgroup(pgroup, proc->last_cpu, allowed);
+    if (idle != NULL) {
+        int err = push_to_cpu(idle, proc, allowed);
+        kick_cpu(idle->cpu_id);
+        if (err == 0) {
+            return;
+        }
+    }
+
+    int err = -1;
+    struct cpu *mycpu = my_cpu();
+    if (cpumask_test(allowed, mycpu->cpu_id)) {
+        err = push_to_cpu(mycpu, proc, allowed);
+    }
+    if (err && proc->last_cpu != -1 && cpumask_test(allowed, proc->last_cpu)) {
+        err = push_to_cpu(&cpus[proc->last_cpu], proc, allowed);
+    }
+    int i;
+    if (err && allowed != CPU_MASK_ALL) {
+        for_each_cpu(i, allowed) {
+            if (run_queue_push_pinned(&cpus[i].rq, proc) == 0) {
+                err = 0;
+                break;
+            }
+        }
+    }
+    if (err && run_queue_push(&pgroup->rq, proc)) {
+        PANIC_FN("group's run queue refuse its proc");
+    }
+    // some cpu may become idle after we looked, let it steal
+    if (kick_idle_cpus(pgroup, 0)) {
+        return;
+    }
+    if (pgroup->id == DEFAULT_PGROUP_ID) {
+        kick_idle_lender();
+    } else {
+        reclaim_lent_cpu(pgroup);
+    }
+}
+
+// call with proc lock, proc must be in a proc group
+void set_proc_runable(struct process *proc)
+{
+    if (proc->pgroup_id == -1) {
+        PANIC_FN("runable proc without proc group");
+    }
+    struct proc_group *pgroup = get_proc_group(proc->pgroup_id);
+    if (proc->status == RUNNING) {
+        // preempted, queue it by its new vruntime
+        update_vruntime(proc);
+    } else {
+        place_proc(pgroup, proc);
+    }
+    proc->status = RUNABLE;
+    queue_proc(pgroup, proc);
+}
+
+// call with RUNABLE proc's lock, return 0 if proc can run on my cpu, otherwise
+// move it to a cpu it can run on
+static int check_proc_cpu(struct cpu *mycpu, struct proc_group *pgroup,
+                          struct process *proc)
+{
+    if (cpumask_test(proc_allowed_cpus(proc, pgroup), mycpu->cpu_id)) {
+        return 0;
+    }
+    queue_proc(pgroup, proc);
+    return -1;
+}
+
+/*
+ * steal a proc from the cpu with the longest run queue in pgroup, pgroup shall
+ * not be freed. procs stay on the cpu they are placed for cache, we only take
+ * one when the cpu is busy running another, an idle one will run it soon.
+ */
+static struct process *steal_proc(struct cpu *mycpu, struct proc_group *pgroup)
+{
+    int busiest = -1;
+    int max_len = 0;
+    int victim;
+    // cpus may change without lock, victim's run queue checks its group
+    cpumask_t others = READ_ONCE(pgroup->cpus) & ~cpumask_of(mycpu->cpu_id);
+    for_each_cpu(victim, others) {
+        if (READ_ONCE(cpus[victim].my_proc) == NULL ||
+            run_queue_can_steal(&cpus[victim].rq) == 0) {
+            continue;
+        }
+
+        int len = run_queue_len(&cpus[victim].rq);
+        if (len > max_len) {
+            busiest = victim;
+            max_len = len;
+        }
+    }
+    if (busiest == -1) {
+        return NULL;
+    }
+    return run_queue_steal(&cpus[busiest].rq, pgroup->id);
+}
+
+// lock the proc poped from pgroup's run queue, NULL if it can't run on my cpu
+static struct process *lock_poped_proc(struct cpu *mycpu, struct process *proc,
+                                       struct proc_group *pgroup)
+{
+    if (proc == NULL) {
+        return NULL;
+    }
+    // proc may be still switching out on other cpu, wait for it
+    acquire_spin_lock(&proc->lock);
+    if (proc->status != RUNABLE || proc->pgroup_id != pgroup->id) {
+        PANIC_FN("get unrunable proc from run queue");
+    }
+    if (check_proc_cpu(mycpu, pgroup, proc)) {
+        release_spin_lock(&proc->lock);
+        return NULL;
+    }
+    return proc;
+}
+
+static struct process *get_runnable_proc_with_lock(struct cpu *mycpu,
+                                                   struct proc_group *pgroup)
+{
+    struct process *proc = run_queue_pop(&mycpu->rq, mycpu->pgroup_id);
+    if (proc == NULL) {
+        proc = run_queue_pop(&pgroup->rq, mycpu->pgroup_id);
+    }
+    if (proc == NULL) {
+        proc = steal_proc(mycpu, pgroup);
+    }
+    return lock_poped_proc(mycpu, proc, pgroup);
+}
+
+// my group has nothing to run, borrow a proc of default group. it is preempted
+// at tick as usual and goes back to default group's run queue, or earlier when
+// my group has work again, see reclaim_lent_cpu()
+static struct process *borrow_proc_with_lock(struct cpu *mycpu)
+{
+    if (cpu_can_lend(mycpu) == 0) {
+        return NULL;
+    }
+    struct proc_group *default_group = get_proc_group(DEFAULT_PGROUP_ID);
+    struct process *proc = run_queue_pop(&default_group->rq, DEFAULT_PGROUP_ID);
+    if (proc == NULL) {
+        proc = steal_proc(mycpu, default_group);
+    }
+    return lock_poped_proc(mycpu, proc, default_group);
+}
+
+// call when there is no runable proc, return 0 if cpu leave the group
+static int leave_pgroup_if_empty(struct proc_group *pgroup)
+{
     acquire_spin_lock(&pgroup->lock);
     if (pgroup->id == -1) {
         PANIC_FN("cpu try to run in empty proc group");
     }
-    if (mycpu->pgroup_id != DEFAULT_PGROUP_ID &&
-        cpu_leave_pgroup_if_empty() == 0) {
-        release_spin_lock(&pgroup->lock);
+    int err = cpu_leave_pgroup_if_empty();
+    release_spin_lock(&pgroup->lock);
+    return err;
+}
+
+// call with proc lock, proc runs on my cpu from now on
+static void set_proc_running(struct cpu *mycpu, struct process *proc)
+{
+    // exclusive occupied proc won't be preempted, it needs no tick
+    if (is_exclusive_occupy(proc)) {
+        tick_oneshot(TIMER_NO_EXPIRES);
+    } else {
+        tick_periodic();
+    }
+
+    mycpu->my_proc = proc;
+    mycpu->lent = proc->pgroup_id != mycpu->pgroup_id;
+    mycpu->slice_left = READ_ONCE(get_proc_group(proc->pgroup_id)->time_slice);
+    proc->status = RUNNING;
+    proc->last_cpu = mycpu->cpu_id;
+    advance_min_vruntime(get_proc_group(proc->pgroup_id), proc);
+    proc->exec_start = READ_REG(CLINT_MTIME);
+}
+
+// call with proc lock, proc stops running on my cpu
+static void put_proc(struct cpu *mycpu, struct process *proc)
+{
+    update_vruntime(proc);
+    mycpu->lent = 0;
+    mycpu->my_proc = NULL;
+}
+
+// call with prev's lock, return next proc of my group with its lock, NULL if
+// there is none. prev itself may be returned if it is RUNABLE
+static struct process *pick_next_proc(struct cpu *mycpu, struct process *prev)
+{
+    // scheduler has other things to do
+    if (mycpu->lent || has_cpu_message(mycpu->cpu_id)) {
+        return NULL;
+    }
+
+    struct proc_group *pgroup = get_proc_group(mycpu->pgroup_id);
+    struct process *next = run_queue_pop(&mycpu->rq, mycpu->pgroup_id);
+    if (next == NULL) {
+        next = run_queue_pop(&pgroup->rq, mycpu->pgroup_id);
+    }
+    if (next == NULL) {
+        return NULL;
+    }
+
+    if (next != prev) {
+        // next is still switching out on other cpu. we can't wait for it
+        // holding prev's lock, as that cpu may wait for prev. leave it to
+        // scheduler, which waits with no lock. next is untouched until its
+        // lock is acquired, so it's ok to push it without the lock
+        if (try_acquire_spin_lock(&next->lock)) {
+            if (run_queue_push(&mycpu->rq, next)) {
+                PANIC_FN("my run queue refuse proc of my group");
+            }
+            return NULL;
+        }
+        if (next->status != RUNABLE || next->pgroup_id != mycpu->pgroup_id) {
+            PANIC_FN("get unrunable proc from run queue");
+        }
+    }
+    if (check_proc_cpu(mycpu, pgroup, next)) {
+        if (next != prev) {
+            release_spin_lock(&next->lock);
+        }
+        return NULL;
+    }
+    return next;
+}
+
+/*
+ * call by switch_to_scheduler() with prev's lock, after prev's status is set.
+ * switch to the next RUNABLE proc of my group without going through
+ * scheduler, return 0 when prev runs again. return -1 if there is no such
+ * proc, caller shall switch to scheduler.
+ *
+ * next holds both locks when it starts, it releases prev's lock in
+ * finish_proc_switch().
+ */
+int switch_to_next_proc(struct process *prev)
+{
+    struct cpu *mycpu = my_cpu();
+    struct process *next = pick_next_proc(mycpu, prev);
+    if (next == NULL) {
+        return -1;
+    }
+
+    put_proc(mycpu, prev);
+    set_proc_running(mycpu, next);
+    if (next == prev) {
         return 0;
     }
+    mycpu->prev_proc = prev;
+    swtch(&prev->proc_context, &next->proc_context);
+    return 0;
+}
+
+// call by a proc switched to, release the lock of proc switched out directly
+void finish_proc_switch(void)
+{
+    struct cpu *mycpu = my_cpu();
+    struct process *prev = mycpu->prev_proc;
+    if (prev != NULL) {
+        mycpu->prev_proc = NULL;
+        release_spin_lock(&prev->lock);
+    }
+}
+
+static int run_process(void)
+{
+    struct cpu *mycpu = my_cpu_unsafe();
+    handle_cpu_acquire(); // mycpu->pgroup_id may change here
 
-    struct process *proc = get_runnable_proc_with_lock(pgroup);
+    // only this cpu can move itself out of the group, so the group won't be
+    // freed and we can pop from its run queues without group lock
+    struct proc_group *pgroup = get_proc_group(mycpu->pgroup_id);
+    struct process *proc = get_runnable_proc_with_lock(mycpu, pgroup);
+    if (proc == NULL) {
+        if (mycpu->pgroup_id != DEFAULT_PGROUP_ID &&
+            leave_pgroup_if_empty(pgroup) == 0) {
+            return 0;
+        }
+        proc = borrow_proc_with_lock(mycpu);
+    }
     if (proc == NULL) {
-        release_spin_lock(&pgroup->lock);
         return -1;
     }
-    proc_move_to_tail(pgroup, proc);
-    release_spin_lock(&pgroup->lock);
 
     // we already got proc lock
     mycpu->origin_ie = 0;
-    mycpu->my_proc = proc;
-    proc->status = RUNNING;
+    set_proc_running(mycpu, proc);
     swtch(&mycpu->scheduler_context, &proc->proc_context);
-    mycpu->my_proc = NULL;
+
+    // procs may switch to each other directly, the one switched back to us
+    // may not be proc
+    proc = mycpu->my_proc;
+    put_proc(mycpu, proc);
     release_spin_lock(&proc->lock);
     return 0;
 }
 
+// racy check, return 1 if there may be RUNABLE procs in pgroup I can take.
+// procs pinned to other cpus are left to them
+static int pgroup_may_have_work(struct proc_group *pgroup)
+{
+    if (run_queue_empty(&pgroup->rq) == 0) {
+        return 1;
+    }
+    int i;
+    for_each_cpu(i, READ_ONCE(pgroup->cpus)) {
+        if (run_queue_can_steal(&cpus[i].rq)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// racy check, return 1 if there may be something for me to do
+static int cpu_may_have_work(struct cpu *mycpu)
+{
+    struct proc_group *pgroup = get_proc_group(mycpu->pgroup_id);
+    if (has_cpu_message(mycpu->cpu_id)) {
+        return 1;
+    }
+    if (mycpu->pgroup_id != DEFAULT_PGROUP_ID &&
+        list_empty(&pgroup->procs_head)) {
+        // try to leave the group
+        return 1;
+    }
+
+    if (run_queue_empty(&mycpu->rq) == 0 || pgroup_may_have_work(pgroup)) {
+        return 1;
+    }
+    return cpu_can_lend(mycpu) &&
+           pgroup_may_have_work(get_proc_group(DEFAULT_PGROUP_ID));
+}
+
+/*
+ * wait for work without tick. the time trap is set to the next timer, and
+ * others kick me if they give me work after idle is set.
+ */
+static void cpu_idle(struct cpu *mycpu)
+{
+    introff();
+    __atomic_store_n(&mycpu->idle, 1, __ATOMIC_SEQ_CST);
+    __sync_synchronize();
+    if (cpu_may_have_work(mycpu) == 0) {
+        tick_oneshot(next_timer_expires());
+        // pending intr in sie wakes us even when intr is off
+        asm volatile("wfi");
+    }
+    __atomic_store_n(&mycpu->idle, 0, __ATOMIC_SEQ_CST);
+    intron();
+}
+
 void scheduler(void)
 {
     intron();
@@ -68,12 +550,48 @@ void scheduler(void)
         intron();
 
         if (no_runable_proc) {
-            // intr has already enable
-            asm volatile("wfi");
+            cpu_idle(my_cpu_unsafe());
         }
     }
 }
 
+/*
+ * set cpus proc pid can run on, 0 for current proc. proc shall be in my
+ * group. return -1 if there is no such proc or mask has no cpu.
+ * a proc not on its cpus moves when it is scheduled next time, current proc
+ * moves at once.
+ */
+int set_proc_affinity(int pid, cpumask_t mask)
+{
+    if ((mask & CPUMASK_POSSIBLE) == 0) {
+        return -1;
+    }
+    struct process *me = my_proc();
+    struct process *proc = me;
+    if (pid == 0) {
+        acquire_spin_lock(&me->lock);
+    } else if ((proc = get_proc_with_lock(pid)) == NULL) {
+        return -1;
+    }
+    if (proc->pgroup_id != me->pgroup_id) {
+        release_spin_lock(&proc->lock);
+        return -1;
+    }
+
+    proc->cpu_mask = mask;
+    int move = 0;
+    if (proc == me) {
+        struct proc_group *pgroup = get_proc_group(me->pgroup_id);
+        cpumask_t allowed = proc_allowed_cpus(me, pgroup);
+        move = cpumask_test(allowed, my_cpu()->cpu_id) == 0;
+    }
+    release_spin_lock(&proc->lock);
+    if (move) {
+        yield(RUNABLE);
+    }
+    return 0;
+}
+
 // debug funciton
 //
 // uint64 handle_proc[MAX_CPU_NUM];
@@ -2,9 +2,29 @@
 #include "cpus.h"
 #include "lock/spin_lock.h"
 #include "process/process.h"
+#include "scheduler/scheduler.h"
 #include "trap/intr_handler.h"
 #include "trap/introff.h"
 #include "util/kprint.h"
+#include "util/list.h"
+
+struct wait_bucket wait_buckets[WAIT_BUCKET_NUM];
+
+void sleep_init(void)
+{
+    for (int i = 0; i < WAIT_BUCKET_NUM; i++) {
+        INIT_LIST_HEAD(&wait_buckets[i].head);
+        init_spin_lock(&wait_buckets[i].lock);
+    }
+}
+
+static struct wait_bucket *get_wait_bucket(void *chain)
+{
+    uint64 key = (uint64)chain;
+    key ^= key >> 6;
+    key ^= key >> 12;
+    return &wait_buckets[key % WAIT_BUCKET_NUM];
+}
 
 void sleep(struct spin_lock *lock, void *chain)
 {
@@ -12,13 +32,25 @@ void sleep(struct spin_lock *lock, void *chain)
     if (proc->chain != NULL) {
         PANIC_FN("sleep when sleeping");
     }
+    if (lock == &proc->lock && chain != NULL) {
+        PANIC_FN("sleep on proc lock with chain");
+    }
 
+    struct wait_bucket *bucket = NULL;
+    if (chain != NULL) {
+        bucket = get_wait_bucket(chain);
+        acquire_spin_lock(&bucket->lock);
+    }
     if (lock != &proc->lock) {
         acquire_spin_lock(&proc->lock);
         release_spin_lock(lock);
     }
     proc->status = SLEEP;
     proc->chain = chain;
+    if (bucket != NULL) {
+        list_add_tail(&proc->wait_list, &bucket->head);
+        release_spin_lock(&bucket->lock);
+    }
 
     switch_to_scheduler();
 
@@ -28,15 +60,28 @@ void sleep(struct spin_lock *lock, void *chain)
     }
 }
 
+// wake up all procs sleeping on chain
 void wake_up(void *chain)
 {
-    for (int i = 0; i < STATIC_PROC_NUM; i++) {
-        struct process *proc = &proc_set[i];
+    struct wait_bucket *bucket = get_wait_bucket(chain);
+    struct process *proc, *next;
+
+    acquire_spin_lock(&bucket->lock);
+    list_for_each_entry_safe(proc, next, &bucket->head, wait_list)
+    {
+        if (proc->chain != chain) {
+            continue;
+        }
+
+        // sleeper holds its lock until it has switched out
         acquire_spin_lock(&proc->lock);
-        if (proc->status == SLEEP && proc->chain == chain) {
-            proc->status = RUNABLE;
-            proc->chain = NULL;
+        if (proc->status != SLEEP) {
+            PANIC_FN("proc in wait bucket is not sleeping");
         }
+        list_del_init(&proc->wait_list);
+        proc->chain = NULL;
+        set_proc_runable(proc);
         release_spin_lock(&proc->lock);
     }
+    release_spin_lock(&bucket->lock);
 }
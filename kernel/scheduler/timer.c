@@ -0,0 +1,197 @@
+#include "scheduler/timer.h"
+#include "cpus.h"
+#include "lock/spin_lock.h"
+#include "process/process.h"
+#include "scheduler/sleep.h"
+#include "trap/intr_handler.h"
+#include "util/kprint.h"
+#include "util/list.h"
+
+struct {
+    struct list_head slots[TIMER_WHEEL_LEVEL][TIMER_WHEEL_SIZE];
+    uint64 base; // next tick to handle
+    struct spin_lock lock;
+} timer_wheel;
+
+void timer_init(void)
+{
+    for (int i = 0; i < TIMER_WHEEL_LEVEL; i++) {
+        for (int j = 0; j < TIMER_WHEEL_SIZE; j++) {
+            INIT_LIST_HEAD(&timer_wheel.slots[i][j]);
+        }
+    }
+    timer_wheel.base = get_ticks();
+    init_spin_lock(&timer_wheel.lock);
+}
+
+void init_timer(struct timer *t, void (*fn)(void *), void *arg)
+{
+    INIT_LIST_HEAD(&t->list);
+    t->expires = 0;
+    t->fn = fn;
+    t->arg = arg;
+}
+
+static uint64 level_shift(int level) { return level * TIMER_WHEEL_BITS; }
+
+// call with timer lock
+static void enqueue_timer(struct timer *t)
+{
+    uint64 base = timer_wheel.base;
+    uint64 expires = t->expires < base ? base : t->expires;
+    uint64 delta = expires - base;
+
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVEL - 1 &&
+           delta >= (1L << level_shift(level + 1))) {
+        level++;
+    }
+    // too far, park in the farthest slot, it will be rehashed when cascaded
+    uint64 max_delta = (1L << level_shift(TIMER_WHEEL_LEVEL)) - 1;
+    if (delta > max_delta) {
+        expires = base + max_delta;
+    }
+
+    int i = (expires >> level_shift(level)) & TIMER_WHEEL_MASK;
+    list_add_tail(&t->list, &timer_wheel.slots[level][i]);
+}
+
+void add_timer(struct timer *t, uint64 expires)
+{
+    acquire_spin_lock(&timer_wheel.lock);
+    if (list_empty(&t->list) == 0) {
+        PANIC_FN("add pending timer");
+    }
+    t->expires = expires;
+    enqueue_timer(t);
+    release_spin_lock(&timer_wheel.lock);
+}
+
+// return 1 if timer is pending and deleted, 0 if it has expired
+int del_timer(struct timer *t)
+{
+    acquire_spin_lock(&timer_wheel.lock);
+    int pending = list_empty(&t->list) == 0;
+    list_del_init(&t->list);
+    release_spin_lock(&timer_wheel.lock);
+    return pending;
+}
+
+// call with timer lock, move timers in the slot to lower levels
+static void cascade(int level, int i)
+{
+    struct list_head timers;
+    INIT_LIST_HEAD(&timers);
+    list_splice_init(&timer_wheel.slots[level][i], &timers);
+
+    struct timer *t, *next;
+    list_for_each_entry_safe(t, next, &timers, list)
+    {
+        list_del_init(&t->list);
+        enqueue_timer(t);
+    }
+}
+
+// call with timer lock, handle timers expire at timer_wheel.base
+static void run_timer_base(void)
+{
+    uint64 base = timer_wheel.base;
+    for (int level = 1; level < TIMER_WHEEL_LEVEL; level++) {
+        // lower level has not wrapped, higher levels don't need to turn
+        if ((base >> level_shift(level - 1)) & TIMER_WHEEL_MASK) {
+            break;
+        }
+        cascade(level, (base >> level_shift(level)) & TIMER_WHEEL_MASK);
+    }
+
+    struct list_head *slot = &timer_wheel.slots[0][base & TIMER_WHEEL_MASK];
+    while (list_empty(slot) == 0) {
+        struct timer *t = list_first_entry(slot, struct timer, list);
+        list_del_init(&t->list);
+        if (t->expires > base) {
+            PANIC_FN("timer expires in the future");
+        }
+        t->fn(t->arg);
+    }
+}
+
+// call on tick, handle all timers expire at or before now
+void run_timers(uint64 now)
+{
+    // every cpu ticks, the first one handles it
+    if (__atomic_load_n(&timer_wheel.base, __ATOMIC_RELAXED) > now) {
+        return;
+    }
+    acquire_spin_lock(&timer_wheel.lock);
+    while (timer_wheel.base <= now) {
+        run_timer_base();
+        timer_wheel.base++;
+    }
+    release_spin_lock(&timer_wheel.lock);
+}
+
+/*
+ * return the tick run_timers() shall be called at, TIMER_NO_EXPIRES if no
+ * timer is pending. it is exact for level 0, and the next cascade tick of the
+ * slot for higher levels, which is no later than any timer in it.
+ */
+uint64 next_timer_expires(void)
+{
+    uint64 next = TIMER_NO_EXPIRES;
+    acquire_spin_lock(&timer_wheel.lock);
+    uint64 base = timer_wheel.base;
+    for (int i = 0; i < TIMER_WHEEL_SIZE; i++) {
+        if (list_empty(&timer_wheel.slots[0][(base + i) & TIMER_WHEEL_MASK]) ==
+            0) {
+            next = base + i;
+            break;
+        }
+    }
+    for (int level = 1; level < TIMER_WHEEL_LEVEL; level++) {
+        uint64 shift = level_shift(level);
+        for (int i = 0; i < TIMER_WHEEL_SIZE; i++) {
+            uint64 turn = (base >> shift) + i;
+            if (list_empty(&timer_wheel.slots[level][turn & TIMER_WHEEL_MASK])) {
+                continue;
+            }
+            uint64 cascade_tick = turn << shift;
+            // the slot has turned for base, its timers wait for the next round
+            if (cascade_tick < base) {
+                cascade_tick += 1L << level_shift(level + 1);
+                next = cascade_tick < next ? cascade_tick : next;
+                continue;
+            }
+            next = cascade_tick < next ? cascade_tick : next;
+            break;
+        }
+    }
+    release_spin_lock(&timer_wheel.lock);
+    return next;
+}
+
+static void wake_up_sleeper(void *proc) { wake_up(proc); }
+
+/*
+ * current proc sleep for ticks, return -1 if it is killed.
+ * proc sleeps on itself, so kill() can wake it up early.
+ */
+int timer_sleep(uint64 ticks)
+{
+    struct process *proc = my_proc();
+    struct timer t;
+    init_timer(&t, wake_up_sleeper, proc);
+
+    acquire_spin_lock(&timer_wheel.lock);
+    t.expires = get_ticks() + ticks;
+    enqueue_timer(&t);
+    while (list_empty(&t.list) == 0) {
+        if (proc->killed) {
+            list_del_init(&t.list);
+            release_spin_lock(&timer_wheel.lock);
+            return -1;
+        }
+        sleep(&timer_wheel.lock, proc);
+    }
+    release_spin_lock(&timer_wheel.lock);
+    return 0;
+}
@@ -8,7 +8,9 @@
 extern void main(void);
 
 __attribute__((aligned(16))) char kstack_for_scheduler[MAX_CPU_NUM][PGSIZE];
-uint64 mtime_setting[MAX_CPU_NUM][6];
+// a line for a hart, each in its own cache line
+__attribute__((aligned(CACHE_LINE_SIZE))) uint64
+    mtime_setting[MAX_CPU_NUM][MTIME_SETTING_SIZE];
 
 void set_m_n_s_csrs(void);
 void setup_time_trap(void);
@@ -58,22 +60,20 @@ void setup_time_trap(void)
     // prepare for mret to s-mode
     w_mstatus(r_mstatus() | XSTATUS_MPIE);
 
-    w_mie(r_mie() | XIE_MTIE);
+    w_mie(r_mie() | XIE_MTIE | XIE_MSIE);
 
     uint64 hart_id = r_tp();
 
     // ask clint for starting time interrput
     uint64 next_intr_time = READ_REG(CLINT_MTIME) + TIME_TRAP_INTERVAL;
     WRITE_REG(CLINT_MTIMECMP(hart_id), next_intr_time);
-    // information for timetrap handler to use
-    // [0] = mtimecmp
-    // [1] = mtime
-    // [2] = interval of the time trap
-    // [3..5] = save registers in time_trap_handler
+    // information for timetrap handler to use, see time_trap_handler.h
     uint64 *my_mtime_setting = mtime_setting[hart_id];
-    my_mtime_setting[0] = CLINT_MTIMECMP(hart_id);
-    my_mtime_setting[1] = CLINT_MTIME;
-    my_mtime_setting[2] = TIME_TRAP_INTERVAL;
+    my_mtime_setting[MTIME_SETTING_MTIMECMP] = CLINT_MTIMECMP(hart_id);
+    my_mtime_setting[MTIME_SETTING_MTIME] = CLINT_MTIME;
+    my_mtime_setting[MTIME_SETTING_INTERVAL] = TIME_TRAP_INTERVAL;
+    my_mtime_setting[MTIME_SETTING_TICK] = 0;
+    my_mtime_setting[MTIME_SETTING_MSIP] = CLINT_MSIP(hart_id);
     w_mscratch((uint64)my_mtime_setting);
 
     w_mtvec((uint64)time_trap_vec);
@@ -0,0 +1,118 @@
+#include "syscall/futex.h"
+#include "lock/spin_lock.h"
+#include "process/proc_mm.h"
+#include "process/process.h"
+#include "riscv/vm_system.h"
+#include "scheduler/sleep.h"
+#include "util/list.h"
+#include "vm/vm.h"
+
+struct futex_waiter {
+    struct futex_key key;
+    struct process *proc;
+    struct list_head list; // in futex_bucket.head, empty once waked
+};
+
+struct futex_bucket futex_buckets[FUTEX_BUCKET_NUM];
+
+void futex_init(void)
+{
+    for (int i = 0; i < FUTEX_BUCKET_NUM; i++) {
+        INIT_LIST_HEAD(&futex_buckets[i].head);
+        init_spin_lock(&futex_buckets[i].lock);
+    }
+}
+
+static struct futex_bucket *get_futex_bucket(struct futex_key *key)
+{
+    uint64 k = (uint64)key->mm ^ key->addr;
+    k ^= k >> 6;
+    k ^= k >> 12;
+    return &futex_buckets[k % FUTEX_BUCKET_NUM];
+}
+
+// key of the word at uva of my proc, -1 if it is not a word user can read
+static int get_futex_key(struct proc_mm *mm, uint64 uva, struct futex_key *key)
+{
+    if (uva % sizeof(uint32)) {
+        return -1;
+    }
+    // the page may not be touched yet
+    if (mm_fault_in(mm->pgtable, uva, FAULT_READ)) {
+        return -1;
+    }
+
+    int err = 0;
+    acquire_spin_lock(&mm->lock);
+    pte *target = walk(mm->pgtable, uva, 0);
+    struct mm_region *region = mm_find_region(mm, uva);
+    if (target == NULL || (*target & (PTE_V | PTE_U | PTE_R)) !=
+                              (PTE_V | PTE_U | PTE_R)) {
+        err = -1;
+    } else if (region != NULL && region->shm != NULL) {
+        key->mm = NULL;
+        key->addr = PTE_GET_PA(*target) + uva % PGSIZE;
+    } else {
+        key->mm = mm;
+        key->addr = uva;
+    }
+    release_spin_lock(&mm->lock);
+    return err;
+}
+
+// sleep until waked if the word at uva is expected. return 0 when waked, -1
+// if the word is not expected or uva is bad
+uint64 futex_wait(struct process *proc, uint64 uva, uint32 expected)
+{
+    struct futex_waiter waiter;
+    if (get_futex_key(proc->mm, uva, &waiter.key)) {
+        return -1;
+    }
+    waiter.proc = proc;
+
+    // read the word through the pgtable as it is now, a store that broke copy
+    // on write after the key was taken is seen
+    struct futex_bucket *bucket = get_futex_bucket(&waiter.key);
+    uint32 word;
+    acquire_spin_lock(&bucket->lock);
+    if (copy_in(proc->proc_pgtable, uva, &word, sizeof(word)) ||
+        word != expected || proc->killed) {
+        release_spin_lock(&bucket->lock);
+        return -1;
+    }
+    list_add_tail(&waiter.list, &bucket->head);
+    sleep(&bucket->lock, proc);
+    // still queued if waked by kill()
+    list_del_init(&waiter.list);
+    release_spin_lock(&bucket->lock);
+    return 0;
+}
+
+// wake at most n procs waiting on the word at uva, return procs waked, -1 if
+// uva is bad
+uint64 futex_wake(struct process *proc, uint64 uva, int n)
+{
+    struct futex_key key;
+    if (n <= 0 || get_futex_key(proc->mm, uva, &key)) {
+        return -1;
+    }
+
+    struct futex_bucket *bucket = get_futex_bucket(&key);
+    struct futex_waiter *waiter, *next;
+    int waked = 0;
+    acquire_spin_lock(&bucket->lock);
+    list_for_each_entry_safe(waiter, next, &bucket->head, list)
+    {
+        if (waked == n) {
+            break;
+        }
+        if (waiter->key.mm != key.mm || waiter->key.addr != key.addr) {
+            continue;
+        }
+        list_del_init(&waiter->list);
+        wake_up(waiter->proc);
+        waked++;
+    }
+    release_spin_lock(&bucket->lock);
+    return waked;
+}
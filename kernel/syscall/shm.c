@@ -0,0 +1,182 @@
+#include "syscall/shm.h"
+#include "lock/spin_lock.h"
+#include "process/proc_mm.h"
+#include "riscv/vm_system.h"
+#include "syscall/mman.h"
+#include "util/kprint.h"
+#include "util/list.h"
+#include "vm/kalloc.h"
+#include "vm/vm.h"
+
+struct shm_segment segments[SHM_NUM];
+// protect all segments
+struct spin_lock shm_lock;
+
+void shm_init(void) { init_spin_lock(&shm_lock); }
+
+// call with shm lock, give back pages of shm and its slot
+static void free_segment(struct shm_segment *shm)
+{
+    for (int i = 0; i < SHM_DIRS; i++) {
+        void **dir = shm->dirs[i];
+        if (dir == NULL) {
+            continue;
+        }
+        for (int j = 0; j < SHM_DIR_LEN; j++) {
+            if (dir[j] != NULL) {
+                kfree(dir[j]);
+            }
+        }
+        kfree(dir);
+        shm->dirs[i] = NULL;
+    }
+    shm->used = 0;
+}
+
+void dup_shm(struct shm_segment *shm)
+{
+    acquire_spin_lock(&shm_lock);
+    shm->ref++;
+    release_spin_lock(&shm_lock);
+}
+
+void put_shm(struct shm_segment *shm)
+{
+    acquire_spin_lock(&shm_lock);
+    if (shm->ref <= 0) {
+        PANIC_FN("put free shm");
+    }
+    if (--shm->ref == 0 && shm->destroyed) {
+        free_segment(shm);
+    }
+    release_spin_lock(&shm_lock);
+}
+
+// return page pgno of shm with a reference, NULL if it is beyond shm or out
+// of memory
+void *shm_page(struct shm_segment *shm, uint64 pgno)
+{
+    acquire_spin_lock(&shm_lock);
+    if (pgno >= shm->npages) {
+        release_spin_lock(&shm_lock);
+        return NULL;
+    }
+    void **dir = shm->dirs[pgno / SHM_DIR_LEN];
+    if (dir == NULL) {
+        dir = shm->dirs[pgno / SHM_DIR_LEN] = get_clear_page();
+    }
+    void *page = NULL;
+    if (dir != NULL) {
+        page = dir[pgno % SHM_DIR_LEN];
+        if (page == NULL) {
+            page = dir[pgno % SHM_DIR_LEN] = get_clear_page();
+        }
+    }
+    if (page != NULL) {
+        kdup(page);
+    }
+    release_spin_lock(&shm_lock);
+    return page;
+}
+
+// create a segment of size bytes, which only proc's group can use with
+// SHM_PGROUP in flags. return its id, -1 if there is no free segment
+uint64 shm_create(struct process *proc, uint64 size, int flags)
+{
+    uint64 npages = ROUND_UP_PGSIZE(size) / PGSIZE;
+    if (size == 0 || npages > SHM_MAX_PAGES) {
+        return -1;
+    }
+
+    acquire_spin_lock(&shm_lock);
+    for (int i = 0; i < SHM_NUM; i++) {
+        struct shm_segment *shm = &segments[i];
+        if (shm->used) {
+            continue;
+        }
+        shm->used = 1;
+        shm->destroyed = 0;
+        shm->ref = 0;
+        shm->pgroup_id = (flags & SHM_PGROUP) ? proc->pgroup_id : -1;
+        shm->npages = npages;
+        release_spin_lock(&shm_lock);
+        return i;
+    }
+    release_spin_lock(&shm_lock);
+    return -1;
+}
+
+// call with shm lock, return the segment of id that proc can use, NULL if
+// there is none
+static struct shm_segment *find_segment(struct process *proc, int id)
+{
+    if (id < 0 || id >= SHM_NUM) {
+        return NULL;
+    }
+    struct shm_segment *shm = &segments[id];
+    if (shm->used == 0 || shm->destroyed ||
+        (shm->pgroup_id != -1 && shm->pgroup_id != proc->pgroup_id)) {
+        return NULL;
+    }
+    return shm;
+}
+
+// map segment id read and write above heap, return the address, -1 if it
+// fails
+uint64 shm_attach(struct process *proc, int id)
+{
+    acquire_spin_lock(&shm_lock);
+    struct shm_segment *shm = find_segment(proc, id);
+    if (shm == NULL) {
+        release_spin_lock(&shm_lock);
+        return -1;
+    }
+    // hold it while we map it
+    shm->ref++;
+    release_spin_lock(&shm_lock);
+
+    struct mm_region new = {
+        .attribute = PTE_R | PTE_W | PTE_U,
+        .shm = shm,
+    };
+    struct proc_mm *mm = proc->mm;
+    acquire_spin_lock(&mm->lock);
+    uint64 va = mm_map_region(mm, shm->npages * PGSIZE, &new);
+    release_spin_lock(&mm->lock);
+    put_shm(shm);
+    return va;
+}
+
+// unmap the segment attached at addr, return -1 if there is none
+uint64 shm_detach(struct process *proc, uint64 addr)
+{
+    LIST_HEAD(freed);
+    struct proc_mm *mm = proc->mm;
+    acquire_spin_lock(&mm->lock);
+    struct mm_region *region = mm_find_region(mm, addr);
+    if (region == NULL || region->shm == NULL || region->start != addr) {
+        release_spin_lock(&mm->lock);
+        return -1;
+    }
+    int err = mm_unmap_range(mm, region->start, region->end, &freed);
+    release_spin_lock(&mm->lock);
+    free_regions(&freed);
+    return err;
+}
+
+// no proc can attach segment id since, it is freed when the last one detaches
+uint64 shm_destroy(struct process *proc, int id)
+{
+    acquire_spin_lock(&shm_lock);
+    struct shm_segment *shm = find_segment(proc, id);
+    if (shm == NULL) {
+        release_spin_lock(&shm_lock);
+        return -1;
+    }
+    shm->destroyed = 1;
+    if (shm->ref == 0) {
+        free_segment(shm);
+    }
+    release_spin_lock(&shm_lock);
+    return 0;
+}
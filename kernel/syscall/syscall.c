@@ -6,6 +6,9 @@
 #include "process/proc_group.h"
 #include "process/process.h"
 #include "riscv/vm_system.h"
+#include "scheduler/scheduler.h"
+#include "syscall/futex.h"
+#include "syscall/shm.h"
 #include "syscall/uvm.h"
 #include "trap/intr_handler.h"
 #include "trap/introff.h"
@@ -34,6 +37,51 @@ uint64 syscall_sbrk(struct process *proc)
 
 uint64 syscall_fork(struct process *proc) { return fork(proc); }
 
+uint64 syscall_clone(struct process *proc)
+{
+    struct trap_frame *tf = proc->proc_trap_frame;
+    return clone(proc, get_arg_n(tf, 0), get_arg_n(tf, 1), get_arg_n(tf, 2));
+}
+
+uint64 syscall_futex_wait(struct process *proc)
+{
+    struct trap_frame *tf = proc->proc_trap_frame;
+    return futex_wait(proc, get_arg_n(tf, 0), get_arg_n(tf, 1));
+}
+
+uint64 syscall_futex_wake(struct process *proc)
+{
+    struct trap_frame *tf = proc->proc_trap_frame;
+    return futex_wake(proc, get_arg_n(tf, 0), get_arg_n(tf, 1));
+}
+
+uint64 syscall_munmap(struct process *proc)
+{
+    struct trap_frame *tf = proc->proc_trap_frame;
+    return munmap(proc, get_arg_n(tf, 0), get_arg_n(tf, 1));
+}
+
+uint64 syscall_shm_create(struct process *proc)
+{
+    struct trap_frame *tf = proc->proc_trap_frame;
+    return shm_create(proc, get_arg_n(tf, 0), get_arg_n(tf, 1));
+}
+
+uint64 syscall_shm_attach(struct process *proc)
+{
+    return shm_attach(proc, get_arg_n(proc->proc_trap_frame, 0));
+}
+
+uint64 syscall_shm_detach(struct process *proc)
+{
+    return shm_detach(proc, get_arg_n(proc->proc_trap_frame, 0));
+}
+
+uint64 syscall_shm_destroy(struct process *proc)
+{
+    return shm_destroy(proc, get_arg_n(proc->proc_trap_frame, 0));
+}
+
 static int copy_in_argv(struct process *proc, int *argc, uint64 argv_uva,
                         char *argv[], char str_in_argv[][ARGV_STR_LEN])
 {
@@ -182,6 +230,49 @@ uint64 syscall_inc_pg_cpus_flex(struct process *proc)
     return inc_pgroup_cpus_flex();
 }
 
+uint64 syscall_get_pg_policy(struct process *proc)
+{
+    return get_pgroup_policy();
+}
+
+uint64 syscall_set_pg_policy(struct process *proc)
+{
+    return set_pgroup_policy(get_arg_n(proc->proc_trap_frame, 0));
+}
+
+uint64 syscall_set_pg_time_slice(struct process *proc)
+{
+    return set_pgroup_time_slice(get_arg_n(proc->proc_trap_frame, 0));
+}
+
+uint64 syscall_set_nice(struct process *proc)
+{
+    return set_my_nice(get_arg_n(proc->proc_trap_frame, 0));
+}
+
+uint64 syscall_set_pg_autoscale(struct process *proc)
+{
+    struct trap_frame *tf = proc->proc_trap_frame;
+    return set_pgroup_autoscale(get_arg_n(tf, 0), get_arg_n(tf, 1),
+                                get_arg_n(tf, 2));
+}
+
+uint64 syscall_set_affinity(struct process *proc)
+{
+    struct trap_frame *tf = proc->proc_trap_frame;
+    return set_proc_affinity(get_arg_n(tf, 0), get_arg_n(tf, 1));
+}
+
+uint64 syscall_pg_barrier_init(struct process *proc)
+{
+    return pgroup_barrier_init(get_arg_n(proc->proc_trap_frame, 0));
+}
+
+uint64 syscall_pg_barrier_wait(struct process *proc)
+{
+    return pgroup_barrier_wait();
+}
+
 // uint64 syscall_getc(struct process *proc) { return console_getc(); }
 
 #define SYSTABLE_ELEM(NAMEC, NAMEL) [SYSCALL_##NAMEC] = syscall_##NAMEL
@@ -198,7 +289,14 @@ syscall_fn_t syscall_table[SYSCALL_NUM] = {
     SYSTABLE_ELEM(MKDIR, mkdir),        SYSTABLE_ELEM(MKNOD, mknod),
     SYSTABLE_ELEM(OPEN, open),          SYSTABLE_ELEM(PIPE, pipe),
     SYSTABLE_ELEM(READ, read),          SYSTABLE_ELEM(UNLINK, unlink),
-    SYSTABLE_ELEM(WRITE, write),
+    SYSTABLE_ELEM(WRITE, write),        SYSTABLE_ELEM(CLONE, clone),
+    SYSTABLE_ELEM(FUTEX_WAIT, futex_wait),
+    SYSTABLE_ELEM(FUTEX_WAKE, futex_wake),
+    SYSTABLE_ELEM(MMAP, mmap),          SYSTABLE_ELEM(MUNMAP, munmap),
+    SYSTABLE_ELEM(SHM_CREATE, shm_create),
+    SYSTABLE_ELEM(SHM_ATTACH, shm_attach),
+    SYSTABLE_ELEM(SHM_DETACH, shm_detach),
+    SYSTABLE_ELEM(SHM_DESTROY, shm_destroy),
 };
 
 #define SYSTABLE_PG_ELEM(NAMEC, NAMEL)                                         \
@@ -215,6 +313,14 @@ syscall_fn_t syscall_pg_table[SYSCALL_PG_NUM] = {
     SYSTABLE_PG_ELEM(PROC_OCCUPY_CPU, proc_occupy_cpu),
     SYSTABLE_PG_ELEM(PROC_RELEASE_CPU, proc_release_cpu),
     SYSTABLE_PG_ELEM(INC_PG_CPUS_FLEX, inc_pg_cpus_flex),
+    SYSTABLE_PG_ELEM(SET_PG_POLICY, set_pg_policy),
+    SYSTABLE_PG_ELEM(SET_NICE, set_nice),
+    SYSTABLE_PG_ELEM(SET_PG_AUTOSCALE, set_pg_autoscale),
+    SYSTABLE_PG_ELEM(SET_PG_TIME_SLICE, set_pg_time_slice),
+    SYSTABLE_PG_ELEM(SET_AFFINITY, set_affinity),
+    SYSTABLE_PG_ELEM(PG_BARRIER_INIT, pg_barrier_init),
+    SYSTABLE_PG_ELEM(PG_BARRIER_WAIT, pg_barrier_wait),
+    SYSTABLE_PG_ELEM(GET_PG_POLICY, get_pg_policy),
 };
 
 int handle_db_syscall(struct process *proc, uint64 syscall_id)
@@ -1,81 +1,158 @@
 #include "syscall/uvm.h"
+#include "fs/defs.h"
+#include "fs/file.h"
+#include "fs/stat.h"
+#include "lock/spin_lock.h"
+#include "process/exec_image.h"
+#include "process/proc_mm.h"
 #include "riscv/vm_system.h"
+#include "syscall/mman.h"
+#include "util/arithmetic.h"
 #include "util/kprint.h"
+#include "util/list.h"
 #include "vm/kalloc.h"
 #include "vm/memory_layout.h"
 #include "vm/vm.h"
 
-int increment_mem_end(struct process *proc, uint64 pages)
+// call with mm lock, other threads may be using the pages
+void decrease_mem_end(struct proc_mm *mm, uint64 pages)
 {
-    uint64 pre_mem_end = proc->mem_end;
-    uint64 cur;
-    for (cur = 0; cur < pages * PGSIZE; cur += PGSIZE) {
-        void *page = kalloc();
-        if (page == NULL) {
-            goto err_ret;
-        }
+    mm_unmap_pages(mm, mm->mem_end - pages * PGSIZE, pages);
+}
+
+static uint64 do_brk(struct proc_mm *mm, uint64 new_brk)
+{
+    uint64 pre_mem_brk = mm->mem_brk;
+    uint64 pre_mem_end = mm->mem_end;
+    if (pre_mem_brk > pre_mem_end) {
+        PANIC_FN("mem_brk > mem_end");
+    }
+    if (pre_mem_end % PGSIZE) {
+        PANIC_FN("mem_end is not aligned to PGSIZE");
+    }
+
+    if (new_brk < mm->mem_start || new_brk >= PROC_VA_END) {
+        return -1;
+    }
 
-        int err = map_page(proc->proc_pgtable, pre_mem_end + cur, (uint64)page,
-                           PTE_R | PTE_W | PTE_X | PTE_U);
-        if (err) {
-            kfree(page);
-            goto err_ret;
+    // pages are allocated on first touch, see mm_handle_fault()
+    uint64 new_mem_end = ROUND_UP_PGSIZE(new_brk);
+    if (new_brk < pre_mem_brk) {
+        if (new_mem_end < pre_mem_end) {
+            decrease_mem_end(mm, (pre_mem_end - new_mem_end) / PGSIZE);
         }
+    } else if (mm_regions_overlap(mm, pre_mem_end, new_mem_end)) {
+        return -1;
     }
 
+    mm->mem_end = new_mem_end;
+    mm->mem_brk = new_brk;
     return 0;
+}
 
-err_ret:
-    unmap_n_pages_free(proc->proc_pgtable, pre_mem_end, cur / PGSIZE);
-    return -1;
+uint64 brk(struct process *proc, uint64 new_brk)
+{
+    acquire_spin_lock(&proc->mm->lock);
+    uint64 ret = do_brk(proc->mm, new_brk);
+    release_spin_lock(&proc->mm->lock);
+    return ret;
 }
 
-void decrease_mem_end(struct process *proc, uint64 pages)
+uint64 sbrk(struct process *proc, int64 increment)
 {
-    unmap_n_pages_free(proc->proc_pgtable, proc->mem_end - pages * PGSIZE,
-                       pages);
+    struct proc_mm *mm = proc->mm;
+    acquire_spin_lock(&mm->lock);
+    uint64 pre_mem_brk = mm->mem_brk;
+    int err = do_brk(mm, mm->mem_brk + increment);
+    release_spin_lock(&mm->lock);
+    if (err) {
+        return -1;
+    }
+
+    return pre_mem_brk;
 }
 
-uint64 brk(struct process *proc, uint64 new_brk)
+static uint64 attribute_from_prot(int prot)
 {
-    uint64 pre_mem_brk = proc->mem_brk;
-    uint64 pre_mem_end = proc->mem_end;
-    if (pre_mem_brk > pre_mem_end) {
-        PANIC_FN("mem_brk > mem_end");
+    uint64 attribute = PTE_U;
+    if (prot & (PROT_READ | PROT_EXEC)) {
+        attribute |= PTE_R;
     }
-    if (pre_mem_end % PGSIZE) {
-        PANIC_FN("mem_end is not aligned to PGSIZE");
+    if (prot & PROT_EXEC) {
+        attribute |= PTE_X;
+    }
+    if (prot & PROT_WRITE) {
+        attribute |= PTE_R | PTE_W;
     }
+    return attribute;
+}
 
-    if (new_brk < proc->mem_start || new_brk >= PROC_VA_END) {
+/*
+ * map length bytes of ip from off, or zeroed memory if ip is NULL, pages are
+ * read on first touch, see struct mm_region. private mappings are copied on
+ * write, shared ones are read only pages of ip, shared with other procs
+ * mapping or running it. return the address, -1 if it fails
+ */
+uint64 mmap(struct process *proc, uint64 length, int prot, int flags,
+            struct inode *ip, uint64 off)
+{
+    int shared = (flags & MAP_SHARED) != 0;
+    if (length == 0 || off % PGSIZE || shared == ((flags & MAP_PRIVATE) != 0) ||
+        (prot & (PROT_READ | PROT_WRITE | PROT_EXEC)) == 0) {
+        return -1;
+    }
+    if (shared && (ip == NULL || (prot & PROT_WRITE))) {
+        return -1;
+    }
+    uint64 size = ROUND_UP_PGSIZE(length);
+    if (size < length || size >= PROC_VA_END) {
         return -1;
     }
 
-    uint64 new_mem_end = ROUND_UP_PGSIZE(new_brk);
-    if (new_brk > pre_mem_end) {
-        int err = increment_mem_end(proc, (new_mem_end - pre_mem_end) / PGSIZE);
-        if (err) {
+    // bytes beyond the end of file are zeroed
+    struct mm_region new = {
+        .attribute = attribute_from_prot(prot),
+        .ip = ip,
+        .file_off = off,
+    };
+    if (ip != NULL) {
+        ilock(ip);
+        int type = ip->type;
+        new.file_size = off < ip->size ? MIN(length, ip->size - off) : 0;
+        iunlock(ip);
+        if (type != T_FILE) {
             return -1;
         }
-    } else if (new_brk < pre_mem_brk) {
-        if (new_mem_end < pre_mem_end) {
-            unmap_n_pages_free(proc->proc_pgtable, new_mem_end,
-                               (pre_mem_end - new_mem_end) / PGSIZE);
+        if ((new.attribute & PTE_W) == 0) {
+            new.image = get_exec_image(ip);
         }
     }
 
-    proc->mem_end = new_mem_end;
-    proc->mem_brk = new_brk;
-    return 0;
+    struct proc_mm *mm = proc->mm;
+    acquire_spin_lock(&mm->lock);
+    uint64 va = mm_map_region(mm, size, &new);
+    release_spin_lock(&mm->lock);
+    if (new.image != NULL) {
+        put_exec_image(new.image);
+    }
+    return va;
 }
 
-uint64 sbrk(struct process *proc, int64 increment)
+// unmap pages of mappings in [addr, addr + length), addr is page aligned.
+// return -1 if it fails
+uint64 munmap(struct process *proc, uint64 addr, uint64 length)
 {
-    uint64 pre_mem_brk = proc->mem_brk;
-    int err = brk(proc, proc->mem_brk + increment);
-    if (err) {
+    uint64 end = ROUND_UP_PGSIZE(addr + length);
+    if (addr % PGSIZE || length == 0 || end <= addr || addr < PROC_VA_START ||
+        end > PROC_VA_END) {
         return -1;
     }
 
-    return pre_mem_brk;
+    LIST_HEAD(freed);
+    struct proc_mm *mm = proc->mm;
+    acquire_spin_lock(&mm->lock);
+    int err = mm_unmap_range(mm, addr, end, &freed);
+    release_spin_lock(&mm->lock);
+    free_regions(&freed);
+    return err;
 }
@@ -4,21 +4,55 @@
 #include "driver/virtio.h"
 #include "fs/defs.h"
 #include "lock/spin_lock.h"
+#include "process/proc_group.h"
+#include "riscv/clint.h"
 #include "riscv/plic.h"
 #include "riscv/regs.h"
 #include "riscv/trap_handle.h"
+#include "scheduler/scheduler.h"
 #include "scheduler/swtch.h"
+#include "scheduler/timer.h"
 #include "trap/introff.h"
+#include "trap/time_trap_handler.h"
 #include "util/kprint.h"
 
-struct spin_lock tick_lock;
-__attribute__((aligned(8))) uint64 tick_count;
+// ticks since boot, read from mtime as harts may not take every tick
+uint64 get_ticks(void) { return READ_REG(CLINT_MTIME) / TIME_TRAP_INTERVAL; }
 
-void intr_init(void) { init_spin_lock(&tick_lock); }
+// call with intr off, time trap every TIME_TRAP_INTERVAL
+void tick_periodic(void)
+{
+    uint64 *setting = mtime_setting[cpu_id()];
+    if (setting[MTIME_SETTING_INTERVAL] != 0) {
+        return;
+    }
+    setting[MTIME_SETTING_INTERVAL] = TIME_TRAP_INTERVAL;
+    __sync_synchronize();
+    WRITE_REG(CLINT_MTIMECMP(cpu_id()),
+              READ_REG(CLINT_MTIME) + TIME_TRAP_INTERVAL);
+}
+
+// call with intr off, one time trap at deadline tick, TIMER_NO_EXPIRES for no
+// time trap
+void tick_oneshot(uint64 deadline)
+{
+    uint64 *setting = mtime_setting[cpu_id()];
+    setting[MTIME_SETTING_INTERVAL] = 0;
+    __sync_synchronize();
+    uint64 mtimecmp = deadline >= TIMER_NO_EXPIRES / TIME_TRAP_INTERVAL
+                          ? TIMER_NO_EXPIRES
+                          : deadline * TIME_TRAP_INTERVAL;
+    WRITE_REG(CLINT_MTIMECMP(cpu_id()), mtimecmp);
+}
+
+// raise a software intrrupt on the cpu, see time_trap_vec
+void kick_cpu(int id) { GET_REG(uint32, CLINT_MSIP(id)) = 1; }
 
-uint64 get_ticks(void)
+// call with intr off, return 1 if the software intrrupt is raised by a tick
+static int tick_happened(void)
 {
-    return __atomic_load_n(&tick_count, __ATOMIC_RELAXED);
+    return __atomic_exchange_n(&mtime_setting[cpu_id()][MTIME_SETTING_TICK], 0,
+                               __ATOMIC_RELAXED);
 }
 
 void switch_to_scheduler(void)
@@ -34,7 +68,10 @@ void switch_to_scheduler(void)
 
     uint64 origin_ie = mycpu->origin_ie;
     mycpu->origin_ie = 0;
-    swtch(&proc->proc_context, &mycpu->scheduler_context);
+    if (switch_to_next_proc(proc)) {
+        swtch(&proc->proc_context, &mycpu->scheduler_context);
+    }
+    finish_proc_switch();
     my_cpu()->origin_ie = origin_ie;
 }
 
@@ -46,7 +83,11 @@ void yield(uint64 status)
 
     acquire_spin_lock(&proc->lock);
 
-    proc->status = status;
+    if (status == RUNABLE) {
+        set_proc_runable(proc);
+    } else {
+        proc->status = status;
+    }
     switch_to_scheduler();
 
     release_spin_lock(&proc->lock);
@@ -71,16 +112,24 @@ void intr_handler(uint64 scause)
     } else if (scause == SCAUSE_SSI) {
         w_sip(r_sip() & (~XIP_SSIP));
 
-        if (cpu_id() == 0) {
-            acquire_spin_lock(&tick_lock);
-            tick_count++;
-            wakeup(&tick_count);
-            release_spin_lock(&tick_lock);
+        // kicked by other cpu, scheduler will find the new work. if i am
+        // lent to default group, my group wants me back
+        if (tick_happened() == 0) {
+            if (my_cpu()->lent) {
+                yield(RUNABLE);
+            }
+            return;
         }
+        run_timers(get_ticks());
+        pgroup_autoscale_tick(get_ticks());
 
         if (my_proc() == NULL || is_exclusive_occupy(my_proc())) {
             return;
         }
+        // proc runs for the time slice of its group
+        if (--my_cpu()->slice_left > 0) {
+            return;
+        }
         yield(RUNABLE);
     } else {
         kprintf("unexpect intrrupt:\n scause: %p\n stval: %p\n", scause,
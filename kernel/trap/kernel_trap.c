@@ -8,10 +8,6 @@
 
 void kernel_trap_init_hart(void)
 {
-    if (cpu_id() == 0) {
-        intr_init();
-    }
-
     w_stvec((uint64)kernel_trap_entry);
     w_sie(XIE_SSIE | XIE_SEIE);
 }
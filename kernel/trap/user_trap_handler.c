@@ -3,6 +3,7 @@
 #include "cpus.h"
 #include "lock/spin_lock.h"
 #include "process/proc_group.h"
+#include "process/proc_mm.h"
 #include "process/process.h"
 #include "riscv/regs.h"
 #include "riscv/trap_handle.h"
@@ -15,12 +16,29 @@
 #include "vm/memory_layout.h"
 #include "vm/vm.h"
 
+// return 0 if proc can go on after the fault
+static int handle_page_fault(struct process *proc, uint64 scause, uint64 va)
+{
+    int access = FAULT_EXEC;
+    if (scause == SCAUSE_STORE_PAGE_FAULT) {
+        access = FAULT_WRITE;
+    } else if (scause == SCAUSE_LOAD_PAGE_FAULT) {
+        access = FAULT_READ;
+    }
+    // it may sleep to read the page from a file
+    intron();
+    return mm_fault_in(proc->proc_pgtable, va, access);
+}
+
 void user_trap_handler(void)
 {
     struct process *proc = my_proc();
     int killed = 0;
+    // TLB was flushed by user_trap_entry
+    mm_deactivate(proc->mm);
 
     uint64 scause = r_scause();
+    uint64 stval = r_stval();
     if (scause == SCAUSE_ECALL_FROM_U) {
         proc->proc_trap_frame->sepc += 4;
         intron();
@@ -30,10 +48,15 @@ void user_trap_handler(void)
         }
     } else if (scause & SCAUSE_INTERRPUT_MASK) {
         intr_handler(scause);
+    } else if ((scause == SCAUSE_INST_PAGE_FAULT ||
+                scause == SCAUSE_LOAD_PAGE_FAULT ||
+                scause == SCAUSE_STORE_PAGE_FAULT) &&
+               handle_page_fault(proc, scause, stval) == 0) {
+        // user can access it now, run the instruction again
     } else {
         kprintf("unexpect exception from user:\n    scause: %p stval: %p\n    "
                 "spec: %p pid: %d\n",
-                scause, r_stval(), r_sepc(), proc->pid);
+                scause, stval, proc->proc_trap_frame->sepc, proc->pid);
         killed = 1;
     }
 
@@ -69,8 +92,9 @@ void user_trap_ret(void)
 
     // prepare for next user trap
     w_stvec(GET_TRAMPOLINE_FN_VA(user_trap_entry));
-    w_sscratch(TRAPFRAME_BASE);
+    w_sscratch(TRAPFRAME_VA(proc->thread_slot));
     proc->proc_trap_frame->cpu_id = cpu_id();
+    mm_activate(proc->mm);
 
     uint64 utrap_ret_end_va = GET_TRAMPOLINE_FN_VA(user_trap_ret_end);
     user_trap_ret_end_t *ret_end_fn = (user_trap_ret_end_t *)utrap_ret_end_va;
@@ -11,6 +11,15 @@ struct mem_list mem_container;
 
 struct spin_lock mem_container_lock;
 
+// references to every page, a page is freed when the last one is dropped.
+// pages are shared by procs after fork, see process/proc_mm.h. atomic
+int page_refs[MEMORY_SIZE / PGSIZE];
+
+static int *get_page_ref(void *pa)
+{
+    return &page_refs[((uint64)pa - KERNEL_BASE) / PGSIZE];
+}
+
 void make_garbage_value(void *m) { memset(m, 0x5, PGSIZE); }
 
 void kalloc_init()
@@ -25,6 +34,7 @@ void kalloc_init()
     }
     for (char *cur_page = (char *)ROUND_UP_PGSIZE(kernel_end); cur_page != end;
          cur_page += PGSIZE) {
+        *get_page_ref(cur_page) = 1;
         kfree(cur_page);
     }
 }
@@ -40,6 +50,7 @@ void *kalloc()
     struct node *mem = mem_container.head;
     mem_container.head = mem->next;
     release_spin_lock(&mem_container_lock);
+    *get_page_ref(mem) = 1;
 
     make_garbage_value(mem);
     return (void *)mem;
@@ -55,6 +66,15 @@ void kfree(void *mem)
     if (mem == NULL) {
         return;
     }
+    // drop a reference, free it with the last one
+    int ref = __atomic_sub_fetch(get_page_ref(mem), 1, __ATOMIC_ACQ_REL);
+    if (ref < 0) {
+        kprintf("try to free page with no reference %p\n", mem);
+        PANIC_FN("free unreferenced page");
+    }
+    if (ref != 0) {
+        return;
+    }
 
     acquire_spin_lock(&mem_container_lock);
     struct node *nd = (struct node *)mem;
@@ -62,3 +82,17 @@ void kfree(void *mem)
     mem_container.head = (void *)nd;
     release_spin_lock(&mem_container_lock);
 }
+
+// add a reference to an allocated page, dropped by kfree()
+void kdup(void *mem)
+{
+    if (__atomic_fetch_add(get_page_ref(mem), 1, __ATOMIC_RELAXED) <= 0) {
+        kprintf("try to dup page with no reference %p\n", mem);
+        PANIC_FN("dup unreferenced page");
+    }
+}
+
+int kref_count(void *mem)
+{
+    return __atomic_load_n(get_page_ref(mem), __ATOMIC_ACQUIRE);
+}
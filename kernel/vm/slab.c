@@ -0,0 +1,65 @@
+#include "vm/slab.h"
+#include "config/basic_config.h"
+#include "lock/spin_lock.h"
+#include "riscv/vm_system.h"
+#include "util/kprint.h"
+#include "vm/kalloc.h"
+
+static void **link_of(struct slab_cache *cache, void *obj)
+{
+    return (void **)((char *)obj + cache->link_offset);
+}
+
+void init_slab_cache(struct slab_cache *cache, uint64 obj_size,
+                     uint64 link_offset, void (*ctor)(void *obj))
+{
+    obj_size = (obj_size + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1UL);
+    if (obj_size > PGSIZE || link_offset + sizeof(void *) > obj_size) {
+        PANIC_FN("bad slab object size");
+    }
+    cache->obj_size = obj_size;
+    cache->link_offset = link_offset;
+    cache->ctor = ctor;
+    cache->free_head = NULL;
+    init_spin_lock(&cache->lock);
+}
+
+// call with cache lock, carve a new page into free objects
+static int grow_cache(struct slab_cache *cache)
+{
+    char *page = kalloc();
+    if (page == NULL) {
+        return -1;
+    }
+    for (char *obj = page; obj + cache->obj_size <= page + PGSIZE;
+         obj += cache->obj_size) {
+        if (cache->ctor != NULL) {
+            cache->ctor(obj);
+        }
+        *link_of(cache, obj) = cache->free_head;
+        cache->free_head = obj;
+    }
+    return 0;
+}
+
+// return NULL if out of memory
+void *slab_alloc(struct slab_cache *cache)
+{
+    acquire_spin_lock(&cache->lock);
+    if (cache->free_head == NULL && grow_cache(cache)) {
+        release_spin_lock(&cache->lock);
+        return NULL;
+    }
+    void *obj = cache->free_head;
+    cache->free_head = *link_of(cache, obj);
+    release_spin_lock(&cache->lock);
+    return obj;
+}
+
+void slab_free(struct slab_cache *cache, void *obj)
+{
+    acquire_spin_lock(&cache->lock);
+    *link_of(cache, obj) = cache->free_head;
+    cache->free_head = obj;
+    release_spin_lock(&cache->lock);
+}
@@ -1,4 +1,7 @@
 #include "vm/vm.h"
+#include "lock/spin_lock.h"
+#include "process/proc_mm.h"
+#include "process/process.h"
 #include "riscv/vm_system.h"
 #include "util/arithmetic.h"
 #include "util/kprint.h"
@@ -175,6 +178,32 @@ void unmap_n_pages_free_hole(page_table pgtable, uint64 va, int n)
     unmap_n_pages_flex(pgtable, va, n, FREE, NO_PANIC);
 }
 
+// unmap n pages but keep their pa in pte, marked by PTE_RSW_0, so they can be
+// freed by free_kept_pages() after TLB of other cpus is flushed. pages not
+// mapped are skipped
+void unmap_n_pages_keep(page_table pgtable, uint64 va, int n)
+{
+    for (int i = 0; i < n; i++, va += PGSIZE) {
+        pte *target = walk(pgtable, va, NO_ALLOC);
+        if (target == NULL || (*target & PTE_V) == 0) {
+            continue;
+        }
+        *target = (*target & PTE_PPN_MASK) | PTE_RSW_0;
+    }
+}
+
+void free_kept_pages(page_table pgtable, uint64 va, int n)
+{
+    for (int i = 0; i < n; i++, va += PGSIZE) {
+        pte *target = walk(pgtable, va, NO_ALLOC);
+        if (target == NULL || (*target & PTE_RSW_0) == 0) {
+            continue;
+        }
+        kfree((void *)PTE_GET_PA(*target));
+        *target = 0;
+    }
+}
+
 void free_page_table_aux(page_table pgtable, int level)
 {
     pte *table = pgtable;
@@ -289,6 +318,39 @@ err_ret:
     return -1;
 }
 
+// map pages of pgtable in [start, end) to mapped_table without copying them.
+// writable ones become read only and PTE_COW in both, the one who stores to
+// it first gets a copy
+int share_page_table_in_interval(page_table mapped_table, page_table pgtable,
+                                 uint64 start, uint64 end)
+{
+    uint64 cur_mem;
+    for (cur_mem = start; cur_mem < end; cur_mem += PGSIZE) {
+        pte *pte = walk(pgtable, cur_mem, NO_ALLOC);
+        if (pte == NULL || (*pte & PTE_V) == 0) {
+            continue;
+        }
+
+        if (*pte & PTE_W) {
+            *pte = (*pte & ~PTE_W) | PTE_COW;
+        }
+        void *page = (void *)PTE_GET_PA(*pte);
+        int err = map_page(mapped_table, cur_mem, (uint64)page,
+                           PTE_GET_ATTRIBUTE(*pte));
+        if (err) {
+            goto err_ret;
+        }
+        kdup(page);
+    }
+
+    return 0;
+
+err_ret:
+    // pages left PTE_COW in pgtable are copied or taken back on store
+    unmap_n_pages_free_hole(mapped_table, start, (cur_mem - start) / PGSIZE);
+    return -1;
+}
+
 int check_uva_attribute_valid(uint64 attribute)
 {
     if ((attribute & PTE_U) == 0)
@@ -298,6 +360,42 @@ int check_uva_attribute_valid(uint64 attribute)
     return 0;
 }
 
+// return 1 if kernel can copy to or from the user page of pte
+static int user_pte_allow(pte *pte, int copy_way)
+{
+    if (pte == NULL || (*pte & PTE_V) == 0 ||
+        check_uva_attribute_valid(PTE_GET_ATTRIBUTE(*pte))) {
+        return 0;
+    }
+    if (copy_way == COPY_OUT || copy_way == COPY_OUT_STR) {
+        return (*pte & PTE_W) != 0;
+    }
+    return 1;
+}
+
+// take a reference to the user page of uva so that it lives through the copy
+// even if another thread unmaps it, NULL if the page can not be copied
+static char *get_user_page(page_table upgtable, uint64 uva, int copy_way)
+{
+    struct process *proc = my_proc();
+    struct proc_mm *mm = NULL;
+    // other pgtables are private to the caller, e.g. the one exec builds
+    if (proc != NULL && proc->proc_pgtable == upgtable) {
+        mm = proc->mm;
+        acquire_spin_lock(&mm->lock);
+    }
+    char *page = NULL;
+    pte *pte = walk(upgtable, uva, NO_ALLOC);
+    if (user_pte_allow(pte, copy_way)) {
+        page = (char *)PTE_GET_PA(*pte);
+        kdup(page);
+    }
+    if (mm != NULL) {
+        release_spin_lock(&mm->lock);
+    }
+    return page;
+}
+
 int copy_str_in_page(char *mem_start, char *kva, uint64 copy_size, int meet_end,
                      int copy_way)
 {
@@ -347,22 +445,26 @@ int handle_copy_for_page_with_way(char *mem_start, char *kva, uint64 copy_size,
 int copy_in_or_out_may_str(page_table upgtable, uint64 uva, char *kva,
                            uint64 size, int copy_way)
 {
+    int write = copy_way == COPY_OUT || copy_way == COPY_OUT_STR;
     while (size > 0) {
-        pte *pte = walk(upgtable, uva, NO_ALLOC);
-        if (pte == NULL) {
-            return -1;
-        }
-        uint64 attribute = PTE_GET_ATTRIBUTE(*pte);
-        if (check_uva_attribute_valid(attribute)) {
-            return -1;
+        char *page = get_user_page(upgtable, uva, copy_way);
+        if (page == NULL) {
+            // as user traps when it accesses the page
+            if (mm_fault_in(upgtable, uva, write ? FAULT_WRITE : FAULT_READ)) {
+                return -1;
+            }
+            page = get_user_page(upgtable, uva, copy_way);
+            if (page == NULL) {
+                return -1;
+            }
         }
 
-        char *page = (char *)PTE_GET_PA(*pte);
         char *mem_start = page + (uva % PGSIZE);
         uint64 page_mem_size = PGSIZE - (uva % PGSIZE);
         uint64 copy_size = MIN(page_mem_size, size);
         int r = handle_copy_for_page_with_way(mem_start, kva, copy_size, size,
                                               copy_way);
+        kfree(page);
         switch (r) {
         case COPY_SUCCESS:
             break;
@@ -0,0 +1,44 @@
+#ifndef SYNC_H_
+#define SYNC_H_
+
+#include "include/config/basic_types.h"
+
+/*
+ * locks for threads and procs sharing memory, they sleep in futex_wait()
+ * instead of spinning when they have to wait. all of them are zeroed or
+ * initialized by *_init() before use.
+ */
+
+// state: 0 unlocked, 1 locked, 2 locked and someone may be waiting
+struct mutex {
+    uint32 state;
+};
+
+// seq is bumped by every signal, waiters sleep on the seq they saw
+struct cond {
+    uint32 seq;
+};
+
+// n threads wait for each other, phase is bumped when they all arrive
+struct barrier {
+    struct mutex lock;
+    struct cond cond;
+    uint32 n;
+    uint32 count;
+    uint32 phase;
+};
+
+void mutex_init(struct mutex *m);
+void mutex_lock(struct mutex *m);
+int mutex_trylock(struct mutex *m);
+void mutex_unlock(struct mutex *m);
+
+void cond_init(struct cond *c);
+void cond_wait(struct cond *c, struct mutex *m);
+void cond_signal(struct cond *c);
+void cond_broadcast(struct cond *c);
+
+void barrier_init(struct barrier *b, int n);
+int barrier_wait(struct barrier *b);
+
+#endif
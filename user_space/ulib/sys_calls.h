@@ -6,6 +6,8 @@
 #include "include/fs/file.h"
 #include "include/fs/fs.h"
 #include "include/fs/stat.h"
+#include "include/scheduler/sched_policy.h"
+#include "include/syscall/mman.h"
 
 // syscall
 int kernelbreak(void);
@@ -20,6 +22,61 @@ int kill(pid_t pid);
 int brk(void *addr);
 uint64 time(uint64 *t);
 
+/*
+ * map length bytes of file fd from offset, which is page aligned, or zeroed
+ * memory with MAP_ANONYMOUS, fd is ignored then. addr is ignored, pass NULL.
+ * prot is PROT_READ, PROT_WRITE and PROT_EXEC or-ed. pages are read or
+ * zeroed on first touch, bytes beyond the end of file read as 0.
+ *
+ * flags is MAP_PRIVATE or MAP_SHARED, with MAP_ANONYMOUS or not. a private
+ * mapping is yours, stores to it are not seen by the file or others, and a
+ * child gets a copy when fork(). a shared mapping is of a file and read only,
+ * its pages are shared with others mapping or running the file. writing the
+ * file after mapping may not be seen by the mapping.
+ *
+ * return value: the address mapped at, MAP_FAILED when fail.
+ */
+void *mmap(void *addr, uint64 length, int prot, int flags, int fd,
+           uint64 offset);
+
+/*
+ * unmap pages of mappings in [addr, addr + length), addr is page aligned.
+ * heap and stacks are not mappings, see sbrk().
+ *
+ * return value: 0 when success, -1 when fail.
+ */
+int munmap(void *addr, uint64 length);
+
+/*
+ * shared memory syscall
+ *
+ * a segment is memory shared by procs attaching it, each at its own addr.
+ * pages are zeroed on first touch, and stay shared with children after
+ * fork(). futex works on it across procs.
+ */
+
+/*
+ * create a segment of size bytes, at most 32MB. with SHM_PGROUP in flags,
+ * only procs in your proc group can attach or destroy it.
+ *
+ * return value: id of the segment when success, -1 when fail.
+ */
+int shm_create(uint64 size, int flags);
+
+// return value: addr the segment is attached at, MAP_FAILED when fail.
+void *shm_attach(int id);
+
+// return value: 0 when the segment attached at addr is detached, -1 when fail.
+int shm_detach(void *addr);
+
+/*
+ * no proc can attach the segment since, it is freed when the last proc
+ * detaches it, or exits or exec()s.
+ *
+ * return value: 0 when success, -1 when fail.
+ */
+int shm_destroy(int id);
+
 // file syscall
 int dup(int);
 int read(int, void *, int);
@@ -34,6 +91,35 @@ int mknod(const char *, short, short);
 int chdir(const char *);
 int pipe(int *);
 
+/*
+ * thread syscall
+ *
+ * start a thread running fn(arg), it shares memory, opened files and cwd with
+ * you, but has its own user stack, which grows on demand up to
+ * USTACK_MAX_PAGES (16) pages. it exits with 0 when fn returns.
+ * a thread is a child of its creator, join it by wait(). at most 16 threads
+ * share memory, and exec() fails before others are joined.
+ *
+ * return value: pid of the thread when success, -1 when fail.
+ */
+int thread_create(void (*fn)(void *), void *arg);
+
+/*
+ * sleep if *addr == expected, until futex_wake() on the same word, which may
+ * be mapped at another addr by another proc. check *addr again when it
+ * returns, it may be waked for other reasons. addr shall be 4 bytes aligned.
+ *
+ * return value: 0 when waked, -1 when *addr != expected or addr is bad.
+ */
+int futex_wait(uint32 *addr, uint32 expected);
+
+/*
+ * wake at most n procs sleeping on addr in futex_wait(), n > 0.
+ *
+ * return value: procs waked, -1 when addr is bad.
+ */
+int futex_wake(uint32 *addr, int n);
+
 /*
  * process group syscall
  *
@@ -102,6 +188,18 @@ int inc_proc_group_cpus_flex(void);
  */
 int dec_proc_group_cpus(void);
 
+/*
+ * let kernel manage your group's cpus. kernel samples load of your group
+ * periodically, load is 100 for every running or RUNABLE proc, and moves cpus
+ * between your group and default group, so that every cpu has about
+ * target_load load. cpu count stays in [min_cpus, max_cpus], as long as there
+ * are free cpus. target_load 0 turns it off. fail in default group, or when
+ * the range is wrong.
+ *
+ * return value: 0 when success, -1 when fail.
+ */
+int set_proc_group_autoscale(int min_cpus, int max_cpus, int target_load);
+
 /*
  * process occupy the cpu.
  * fail if your group have more than 1 cpu or 1 process.
@@ -123,6 +221,67 @@ int proc_occupy_cpu(void);
  */
 int proc_release_cpu(void);
 
+/*
+ * --- syscalls below are scheduling in process group syscall
+ */
+/*
+ * set scheduling policy of your group, SCHED_RR or SCHED_FAIR, see
+ * include/scheduler/sched_policy.h. new group uses SCHED_RR.
+ *
+ * return value: 0 when success, -1 when policy is unknown.
+ */
+int set_proc_group_policy(int policy);
+
+// return value: scheduling policy of your group, SCHED_RR or SCHED_FAIR.
+int get_proc_group_policy(void);
+
+/*
+ * set ticks procs of your group run before they are preempted,
+ * TIME_SLICE_MIN ~ TIME_SLICE_MAX. long slice means less context switch, short
+ * slice means quick response. new group uses TIME_SLICE_DEFAULT.
+ *
+ * return value: 0 when success, -1 when ticks is out of range.
+ */
+int set_proc_group_time_slice(int ticks);
+
+/*
+ * set nice of current proc, NICE_MIN ~ NICE_MAX. under SCHED_FAIR, proc with
+ * lower nice gets more cpu time, a nice step is about 10%. child inherits it.
+ *
+ * return value: 0 when success, -1 when nice is out of range.
+ */
+int set_proc_nice(int nice);
+
+/*
+ * set cpus proc pid can run on, bit i of cpu_mask for cpu i, pid 0 for
+ * yourself. proc shall be in your group, and it runs on any cpu of the group
+ * if none of them is in cpu_mask. child inherits it. CPU_MASK_ALL by default.
+ *
+ * return value: 0 when success, -1 when there is no such proc in your group or
+ * cpu_mask has no cpu.
+ */
+int set_proc_affinity(pid_t pid, uint64 cpu_mask);
+
+/*
+ * set procs the barrier of your group waits for, n > 0. fail if some procs
+ * are waiting on it. a group has one barrier, any proc in the group can use
+ * it.
+ *
+ * return value: 0 when success, -1 when fail.
+ */
+int pgroup_barrier_init(int n);
+
+/*
+ * wait until n procs of your group call it, n is set by
+ * pgroup_barrier_init(). then they all return and the barrier can be used
+ * again. if your group has n cpus or more, it spins a short time before
+ * sleeping.
+ *
+ * return value: 1 for the last proc arrived, 0 for others, -1 when barrier is
+ * not inited or you are killed.
+ */
+int pgroup_barrier_wait(void);
+
 // debug syscall
 int count_proc_num(void);
 
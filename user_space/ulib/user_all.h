@@ -2,6 +2,7 @@
 #define USER_ALL_H_
 
 #include "malloc.h"
+#include "sync.h"
 #include "sys_calls.h"
 #include "user_lib.h"
 
@@ -0,0 +1,91 @@
+#include "ulib/user_all.h"
+
+#define WAKE_ALL 0x7fffffff
+
+void mutex_init(struct mutex *m) { m->state = 0; }
+
+// return 0 when success, -1 if m is locked
+int mutex_trylock(struct mutex *m)
+{
+    uint32 c = 0;
+    return __atomic_compare_exchange_n(&m->state, &c, 1, 0, __ATOMIC_ACQUIRE,
+                                       __ATOMIC_RELAXED)
+               ? 0
+               : -1;
+}
+
+// lock as if someone is waiting, so unlock will wake one
+static void mutex_lock_contended(struct mutex *m)
+{
+    while (__atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE) != 0) {
+        futex_wait(&m->state, 2);
+    }
+}
+
+void mutex_lock(struct mutex *m)
+{
+    if (mutex_trylock(m) == 0) {
+        return;
+    }
+    mutex_lock_contended(m);
+}
+
+void mutex_unlock(struct mutex *m)
+{
+    if (__atomic_exchange_n(&m->state, 0, __ATOMIC_RELEASE) == 2) {
+        futex_wake(&m->state, 1);
+    }
+}
+
+void cond_init(struct cond *c) { c->seq = 0; }
+
+// call with m locked, it is locked again when return. check your condition
+// again, it may return without signal
+void cond_wait(struct cond *c, struct mutex *m)
+{
+    uint32 seq = __atomic_load_n(&c->seq, __ATOMIC_RELAXED);
+    mutex_unlock(m);
+    futex_wait(&c->seq, seq);
+    // others may be waked with us
+    mutex_lock_contended(m);
+}
+
+void cond_signal(struct cond *c)
+{
+    __atomic_fetch_add(&c->seq, 1, __ATOMIC_RELEASE);
+    futex_wake(&c->seq, 1);
+}
+
+void cond_broadcast(struct cond *c)
+{
+    __atomic_fetch_add(&c->seq, 1, __ATOMIC_RELEASE);
+    futex_wake(&c->seq, WAKE_ALL);
+}
+
+void barrier_init(struct barrier *b, int n)
+{
+    mutex_init(&b->lock);
+    cond_init(&b->cond);
+    b->n = n;
+    b->count = 0;
+    b->phase = 0;
+}
+
+// return 1 for the last one arrived, 0 for others
+int barrier_wait(struct barrier *b)
+{
+    mutex_lock(&b->lock);
+    uint32 phase = b->phase;
+    if (++b->count == b->n) {
+        b->count = 0;
+        b->phase++;
+        cond_broadcast(&b->cond);
+        mutex_unlock(&b->lock);
+        return 1;
+    }
+    while (phase == b->phase) {
+        cond_wait(&b->cond, &b->lock);
+    }
+    mutex_unlock(&b->lock);
+    return 0;
+}
@@ -632,6 +632,227 @@ static void do_enter_pg(char *s)
 // test multiple times to ensure every group been freed correctly.
 void enter_pg(char *s) { do_test_n_times(s, do_enter_pg, 9); }
 
+// does set_proc_group_autoscale() check its args, and can autoscale group
+// finish its work while cpus move?
+void pg_autoscale(char *s)
+{
+    if (set_proc_group_autoscale(1, 2, 100) == 0) {
+        printf("%s: autoscale default group success\n", s);
+        exit(1);
+    }
+    if (create_proc_group() == -1) {
+        printf("%s: create proc group fail\n", s);
+        exit(1);
+    }
+    int bad[4][3] = { { 0, 1, 100 }, { 2, 1, 100 }, { 1, 1000, 100 },
+                      { 1, 2, -1 } };
+    for (int i = 0; i < LEN(bad, int[3]); i++) {
+        if (set_proc_group_autoscale(bad[i][0], bad[i][1], bad[i][2]) == 0) {
+            printf("%s: bad autoscale args %d success\n", s, i);
+            exit(1);
+        }
+    }
+    if (set_proc_group_autoscale(1, 8, 100) != 0) {
+        printf("%s: set autoscale fail\n", s);
+        exit(1);
+    }
+
+    for (int i = 0; i < 4; i++) {
+        int pid = fork();
+        if (pid < 0) {
+            printf("%s: fork failed\n", s);
+            exit(1);
+        }
+        if (pid == 0) {
+            for (volatile int j = 0; j < 10000000; j++) {
+            }
+            exit(0);
+        }
+    }
+    int xstatus = wait_children(s, 4);
+    set_proc_group_autoscale(1, 1, 0);
+    exit(xstatus);
+}
+
+// do set_proc_nice() and set_proc_group_policy() check their args, and do procs
+// of different nice still run to the end under both policies?
+void sched_policy(char *s)
+{
+    int bad_nice[4] = { NICE_MIN - 1, NICE_MAX + 1, -1000, 1000 };
+    for (int i = 0; i < LEN(bad_nice, int); i++) {
+        if (set_proc_nice(bad_nice[i]) == 0) {
+            printf("%s: set_proc_nice(%d) success\n", s, bad_nice[i]);
+            exit(1);
+        }
+    }
+    if (set_proc_group_policy(-1) == 0 || set_proc_group_policy(100) == 0) {
+        printf("%s: set unknown policy success\n", s);
+        exit(1);
+    }
+
+    int old_policy = get_proc_group_policy();
+    int policy[3] = { SCHED_RR, SCHED_FAIR, SCHED_RR };
+    for (int i = 0; i < LEN(policy, int); i++) {
+        if (set_proc_group_policy(policy[i]) != 0) {
+            printf("%s: set policy %d fail\n", s, policy[i]);
+            exit(1);
+        }
+        for (int nice = NICE_MIN; nice <= NICE_MAX; nice += 13) {
+            int pid = fork();
+            if (pid < 0) {
+                printf("%s: fork failed\n", s);
+                exit(1);
+            }
+            if (pid == 0) {
+                if (set_proc_nice(nice) != 0) {
+                    printf("%s: set_proc_nice(%d) fail\n", s, nice);
+                    exit(1);
+                }
+                for (volatile int j = 0; j < 1000000; j++) {
+                }
+                exit(0);
+            }
+        }
+        if (wait_children(s, 4)) {
+            exit(1);
+        }
+    }
+    set_proc_group_policy(old_policy);
+    exit(0);
+}
+
+// does set_proc_group_time_slice() check its arg, and do procs still share
+// cpus under long and short slices?
+void time_slice(char *s)
+{
+    if (set_proc_group_time_slice(TIME_SLICE_MIN - 1) == 0 ||
+        set_proc_group_time_slice(TIME_SLICE_MAX + 1) == 0) {
+        printf("%s: set bad time slice success\n", s);
+        exit(1);
+    }
+
+    int slice[3] = { TIME_SLICE_MAX, TIME_SLICE_MIN, TIME_SLICE_DEFAULT };
+    for (int i = 0; i < LEN(slice, int); i++) {
+        if (set_proc_group_time_slice(slice[i]) != 0) {
+            printf("%s: set time slice %d fail\n", s, slice[i]);
+            exit(1);
+        }
+        for (int j = 0; j < 3; j++) {
+            int pid = fork();
+            if (pid < 0) {
+                printf("%s: fork failed\n", s);
+                exit(1);
+            }
+            if (pid == 0) {
+                for (volatile int k = 0; k < 1000000; k++) {
+                }
+                exit(0);
+            }
+        }
+        if (wait_children(s, 3)) {
+            exit(1);
+        }
+    }
+    exit(0);
+}
+
+// does set_proc_affinity() check its args, and do procs pinned to a cpu, by
+// themselves or by others, still run to the end?
+void affinity(char *s)
+{
+    if (set_proc_affinity(0, 0) == 0) {
+        printf("%s: set empty cpu mask success\n", s);
+        exit(1);
+    }
+    if (set_proc_affinity(1000000, CPU_MASK_ALL) == 0) {
+        printf("%s: set affinity of no proc success\n", s);
+        exit(1);
+    }
+
+    for (int i = 0; i < 4; i++) {
+        int pid = fork();
+        if (pid < 0) {
+            printf("%s: fork failed\n", s);
+            exit(1);
+        }
+        if (pid == 0) {
+            if (set_proc_affinity(0, 1UL << (i % 2)) != 0) {
+                printf("%s: pin myself fail\n", s);
+                exit(1);
+            }
+            for (volatile int j = 0; j < 1000000; j++) {
+            }
+            exit(0);
+        }
+        if (set_proc_affinity(pid, 1UL << (i % 2)) != 0) {
+            printf("%s: pin child fail\n", s);
+            exit(1);
+        }
+    }
+    if (wait_children(s, 4)) {
+        exit(1);
+    }
+    if (set_proc_affinity(0, 1) != 0 || set_proc_affinity(0, CPU_MASK_ALL)) {
+        printf("%s: pin myself fail\n", s);
+        exit(1);
+    }
+    exit(0);
+}
+
+static volatile uint64 barrier_arrived;
+static volatile uint64 barrier_last;
+
+static void pg_barrier_worker(void *arg)
+{
+    uint64 n = (uint64)arg;
+    for (int phase = 0; phase < 3; phase++) {
+        __atomic_fetch_add(&barrier_arrived, 1, __ATOMIC_RELAXED);
+        int ret = pgroup_barrier_wait();
+        if (ret < 0) {
+            exit(1);
+        }
+        if (ret == 1) {
+            __atomic_fetch_add(&barrier_last, 1, __ATOMIC_RELAXED);
+        }
+        // nobody passes before all arrive
+        if (barrier_arrived < (phase + 1) * n) {
+            exit(1);
+        }
+    }
+}
+
+// does the group barrier hold every thread until all of them arrive, in every
+// phase?
+void pg_barrier(char *s)
+{
+    enum { N = 4 };
+    if (pgroup_barrier_init(0) == 0) {
+        printf("%s: init barrier with 0 proc success\n", s);
+        exit(1);
+    }
+    if (pgroup_barrier_init(N) != 0) {
+        printf("%s: init barrier fail\n", s);
+        exit(1);
+    }
+    barrier_arrived = 0;
+    barrier_last = 0;
+
+    for (int i = 0; i < N; i++) {
+        if (thread_create(pg_barrier_worker, (void *)(uint64)N) < 0) {
+            printf("%s: thread_create failed\n", s);
+            exit(1);
+        }
+    }
+    if (wait_children(s, N)) {
+        exit(1);
+    }
+    if (barrier_last != 3) {
+        printf("%s: %d last arrivers, expect 3\n", s, (int)barrier_last);
+        exit(1);
+    }
+    exit(0);
+}
+
 // what if you pass ridiculous pointers to system calls
 // that read user memory with copyin?
 void copyin(char *s)
@@ -1499,6 +1720,588 @@ void forkfork(char *s)
     }
 }
 
+// can more procs than the old 64 slots live at once, and be killed and
+// waited?
+void manyprocs(char *s)
+{
+    enum { N = 100 };
+    int pids[N];
+
+    for (int i = 0; i < N; i++) {
+        pids[i] = fork();
+        if (pids[i] < 0) {
+            printf("%s: fork %d failed\n", s, i);
+            exit(1);
+        }
+        if (pids[i] == 0) {
+            while (1) {
+                sleep(1);
+            }
+        }
+    }
+    for (int i = 0; i < N; i++) {
+        if (kill(pids[i]) != 0) {
+            printf("%s: kill %d failed\n", s, pids[i]);
+            exit(1);
+        }
+    }
+    for (int i = 0; i < N; i++) {
+        if (wait(0) < 0) {
+            printf("%s: wait failed\n", s);
+            exit(1);
+        }
+    }
+    if (kill(pids[0]) == 0) {
+        printf("%s: kill a freed proc success\n", s);
+        exit(1);
+    }
+}
+
+static volatile uint64 thread_sum;
+
+static void thread_add(void *arg)
+{
+    uint64 *page = arg;
+    for (int i = 0; i < 1000; i++) {
+        __atomic_fetch_add(&thread_sum, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(page, 1, __ATOMIC_RELAXED);
+    }
+}
+
+void threads(char *s)
+{
+    enum { N = 4 };
+    // threads share memory grown after they are created
+    uint64 *page = sbrk(4096);
+    if (page == (uint64 *)-1) {
+        printf("%s: sbrk failed\n", s);
+        exit(1);
+    }
+    *page = 0;
+    thread_sum = 0;
+
+    for (int i = 0; i < N; i++) {
+        if (thread_create(thread_add, page) < 0) {
+            printf("%s: thread_create %d failed\n", s, i);
+            exit(1);
+        }
+    }
+    char *argv[] = { "echo", 0 };
+    if (exec("echo", argv) != -1) {
+        printf("%s: exec with threads success\n", s);
+        exit(1);
+    }
+    for (int i = 0; i < N; i++) {
+        int xstatus;
+        if (wait(&xstatus) < 0 || xstatus != 0) {
+            printf("%s: join failed\n", s);
+            exit(1);
+        }
+    }
+    if (thread_sum != N * 1000 || *page != N * 1000) {
+        printf("%s: sum %d, expect %d\n", s, (int)thread_sum, N * 1000);
+        exit(1);
+    }
+    sbrk(-4096);
+}
+
+static struct mutex sync_lock;
+static struct barrier sync_barrier;
+static int sync_count;
+static int sync_after_barrier;
+
+static void thread_sync(void *arg)
+{
+    for (int i = 0; i < 1000; i++) {
+        mutex_lock(&sync_lock);
+        sync_count++;
+        mutex_unlock(&sync_lock);
+    }
+    barrier_wait(&sync_barrier);
+    // everyone has finished counting
+    if (sync_count != 4 * 1000) {
+        exit(1);
+    }
+    mutex_lock(&sync_lock);
+    sync_after_barrier++;
+    mutex_unlock(&sync_lock);
+}
+
+void threadsync(char *s)
+{
+    enum { N = 4 };
+    mutex_init(&sync_lock);
+    barrier_init(&sync_barrier, N);
+    sync_count = 0;
+    sync_after_barrier = 0;
+
+    for (int i = 0; i < N; i++) {
+        if (thread_create(thread_sync, 0) < 0) {
+            printf("%s: thread_create %d failed\n", s, i);
+            exit(1);
+        }
+    }
+    for (int i = 0; i < N; i++) {
+        int xstatus;
+        if (wait(&xstatus) < 0 || xstatus != 0) {
+            printf("%s: thread passed barrier early\n", s);
+            exit(1);
+        }
+    }
+    if (sync_count != N * 1000 || sync_after_barrier != N) {
+        printf("%s: count %d, expect %d\n", s, sync_count, N * 1000);
+        exit(1);
+    }
+    uint32 word = 1;
+    if (futex_wait(&word, 0) != -1) {
+        printf("%s: futex_wait on changed word success\n", s);
+        exit(1);
+    }
+}
+
+static void thread_futex_store(void *arg)
+{
+    volatile uint32 *word = arg;
+    for (volatile int i = 0; i < 100000; i++) {
+    }
+    *word = 1;
+    futex_wake((uint32 *)word, 1);
+}
+
+// does a futex wake reach its waiter after the store before it moves the page
+// copy on write, and does futex work on a page never touched?
+void futexcow(char *s)
+{
+    volatile uint32 *word = sbrk(2 * PGSIZE);
+    if (word == (uint32 *)-1) {
+        printf("%s: sbrk failed\n", s);
+        exit(1);
+    }
+    uint32 *lazy = (uint32 *)((char *)word + PGSIZE);
+    if (futex_wait(lazy, 1) != -1 || futex_wake(lazy, 1) != 0) {
+        printf("%s: futex on untouched page failed\n", s);
+        exit(1);
+    }
+
+    *word = 0;
+    // the child shares the page copy on write until it exits
+    int pid = fork();
+    if (pid < 0) {
+        printf("%s: fork failed\n", s);
+        exit(1);
+    }
+    if (pid == 0) {
+        sleep(10);
+        exit(0);
+    }
+    if (thread_create(thread_futex_store, (void *)word) < 0) {
+        printf("%s: thread_create failed\n", s);
+        exit(1);
+    }
+    while (*word == 0) {
+        futex_wait((uint32 *)word, 0);
+    }
+    if (wait_children(s, 2)) {
+        exit(1);
+    }
+    sbrk(-2 * PGSIZE);
+}
+
+static char *unmap_buf;
+static char *unmap_reuse;
+
+static void thread_unmap(void *arg)
+{
+    uint64 n = (uint64)arg;
+    for (volatile int i = 0; i < 100000; i++) {
+    }
+    munmap(unmap_buf, n);
+    // take the freed pages back, a copy still going on would clobber them
+    char *p = sbrk(n);
+    if (p == (char *)-1) {
+        exit(1);
+    }
+    memset(p, 'p', n);
+    unmap_reuse = p;
+}
+
+// does read() into a buffer another thread unmaps fail without writing to
+// the pages after they are freed?
+void unmapread(char *s)
+{
+    enum { N = 8 };
+    int fd = open("unmapread", O_CREATE | O_RDWR);
+    if (fd < 0) {
+        printf("%s: open failed\n", s);
+        exit(1);
+    }
+    static char data[PGSIZE];
+    memset(data, 'd', PGSIZE);
+    for (int i = 0; i < N; i++) {
+        if (write(fd, data, PGSIZE) != PGSIZE) {
+            printf("%s: write failed\n", s);
+            exit(1);
+        }
+    }
+    close(fd);
+
+    unmap_buf = mmap(NULL, N * PGSIZE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (unmap_buf == MAP_FAILED) {
+        printf("%s: mmap failed\n", s);
+        exit(1);
+    }
+    unmap_reuse = 0;
+    if (thread_create(thread_unmap, (void *)(uint64)(N * PGSIZE)) < 0) {
+        printf("%s: thread_create failed\n", s);
+        exit(1);
+    }
+    int i;
+    for (i = 0; i < 10000; i++) {
+        fd = open("unmapread", O_RDONLY);
+        int n = read(fd, unmap_buf, N * PGSIZE);
+        close(fd);
+        if (n != N * PGSIZE) {
+            break;
+        }
+    }
+    if (i == 10000) {
+        printf("%s: read into unmapped buffer success\n", s);
+        exit(1);
+    }
+    int xstatus;
+    if (wait(&xstatus) < 0 || xstatus != 0 || unmap_reuse == 0) {
+        printf("%s: join failed\n", s);
+        exit(1);
+    }
+    for (int j = 0; j < N * PGSIZE; j++) {
+        if (unmap_reuse[j] != 'p') {
+            printf("%s: freed page written at %d\n", s, j);
+            exit(1);
+        }
+    }
+    sbrk(-(N * PGSIZE));
+    unlink("unmapread");
+}
+
+// do a forked child and its parent see their own stores only, to pages
+// shared copy on write?
+void cowfork(char *s)
+{
+    enum { N = 64 };
+    char *mem = sbrk(N * 4096);
+    if (mem == (char *)-1) {
+        printf("%s: sbrk failed\n", s);
+        exit(1);
+    }
+    for (int i = 0; i < N; i++) {
+        mem[i * 4096] = i;
+    }
+
+    int pid = fork();
+    if (pid < 0) {
+        printf("%s: fork failed\n", s);
+        exit(1);
+    }
+    if (pid == 0) {
+        for (int i = 0; i < N; i++) {
+            if (mem[i * 4096] != i) {
+                printf("%s: child read wrong value\n", s);
+                exit(1);
+            }
+            mem[i * 4096] = -i;
+        }
+        // kernel stores to shared pages too
+        int fds[2];
+        if (pipe(fds) < 0 || write(fds[1], "x", 1) != 1 ||
+            read(fds[0], mem + 4096 * 3, 1) != 1 || mem[4096 * 3] != 'x') {
+            printf("%s: child read into shared page fail\n", s);
+            exit(1);
+        }
+        exit(0);
+    }
+
+    int xstatus;
+    if (wait(&xstatus) != pid || xstatus != 0) {
+        exit(1);
+    }
+    for (int i = 0; i < N; i++) {
+        if (mem[i * 4096] != i) {
+            printf("%s: parent sees child's store\n", s);
+            exit(1);
+        }
+    }
+    sbrk(-N * 4096);
+}
+
+static int deep_stack(int depth)
+{
+    volatile char buf[2048];
+    buf[0] = depth;
+    buf[sizeof(buf) - 1] = depth;
+    if (depth == 0) {
+        return 0;
+    }
+    return deep_stack(depth - 1) + buf[0] - buf[sizeof(buf) - 1];
+}
+
+// are heap pages given on first touch only, and does the stack grow beyond
+// its first page, in parent and forked child?
+void lazymem(char *s)
+{
+    // more than physical memory, only pages touched are allocated
+    enum { BIG = 512 * 1024 * 1024 };
+    char *mem = sbrk(BIG);
+    if (mem == (char *)-1) {
+        printf("%s: sbrk %d failed\n", s, BIG);
+        exit(1);
+    }
+    for (int i = 0; i < 16; i++) {
+        mem[(uint64)BIG / 16 * i] = i;
+    }
+    for (int i = 0; i < 16; i++) {
+        if (mem[(uint64)BIG / 16 * i] != i || mem[(uint64)BIG / 16 * i + 1]) {
+            printf("%s: lazy page holds wrong value\n", s);
+            exit(1);
+        }
+    }
+    sbrk(-BIG);
+
+    if (deep_stack(20) != 0) {
+        printf("%s: stack grows wrong\n", s);
+        exit(1);
+    }
+    int pid = fork();
+    if (pid < 0) {
+        printf("%s: fork failed\n", s);
+        exit(1);
+    }
+    if (pid == 0) {
+        exit(deep_stack(20));
+    }
+    int xstatus;
+    if (wait(&xstatus) != pid || xstatus != 0) {
+        printf("%s: stack grows wrong in child\n", s);
+        exit(1);
+    }
+}
+
+// in the file image, read on first touch
+static char lazy_data[3 * PGSIZE] = { 'l', 'a', 'z', 'y' };
+static const char lazy_rodata[3 * PGSIZE] = { 'r', 'o' };
+static int lazy_word = 12345;
+
+void lazyexec(char *s)
+{
+    // from and to pages never touched, which are read with fs locks held
+    int fd = open("lazyexec", O_CREATE | O_RDWR);
+    if (fd < 0) {
+        printf("%s: create failed\n", s);
+        exit(1);
+    }
+    if (write(fd, lazy_rodata, sizeof(lazy_rodata)) != sizeof(lazy_rodata)) {
+        printf("%s: write failed\n", s);
+        exit(1);
+    }
+    close(fd);
+    fd = open("lazyexec", O_RDONLY);
+    if (read(fd, lazy_data + PGSIZE, PGSIZE) != PGSIZE) {
+        printf("%s: read failed\n", s);
+        exit(1);
+    }
+    close(fd);
+    unlink("lazyexec");
+    if (lazy_data[PGSIZE] != 'r' || lazy_data[PGSIZE + 1] != 'o' ||
+        lazy_data[PGSIZE + 2] != 0) {
+        printf("%s: read wrong data\n", s);
+        exit(1);
+    }
+
+    int fds[2];
+    if (pipe(fds) != 0) {
+        printf("%s: pipe failed\n", s);
+        exit(1);
+    }
+    if (write(fds[1], lazy_data, 4) != 4 ||
+        read(fds[0], lazy_data + 2 * PGSIZE, 4) != 4) {
+        printf("%s: pipe read or write failed\n", s);
+        exit(1);
+    }
+    close(fds[0]);
+    close(fds[1]);
+    if (memcmp(lazy_data + 2 * PGSIZE, "lazy", 4) != 0) {
+        printf("%s: pipe read wrong data\n", s);
+        exit(1);
+    }
+
+    int pid = fork();
+    if (pid < 0) {
+        printf("%s: fork failed\n", s);
+        exit(1);
+    }
+    if (pid == 0) {
+        exit(lazy_word != 12345);
+    }
+    int xstatus;
+    if (wait(&xstatus) != pid || xstatus != 0) {
+        printf("%s: child read wrong data\n", s);
+        exit(1);
+    }
+}
+
+// text is read only, shared by procs running the binary
+void textwrite(char *s)
+{
+    int pid = fork();
+    if (pid < 0) {
+        printf("%s: fork failed\n", s);
+        exit(1);
+    }
+    if (pid == 0) {
+        volatile int *addr = (int *)textwrite;
+        *addr = 10;
+        exit(0);
+    }
+    int xstatus;
+    if (wait(&xstatus) != pid || xstatus != -1) {
+        printf("%s: write to text succeeded\n", s);
+        exit(1);
+    }
+}
+
+// return xstatus of a child storing c to addr
+static int store_in_child(char *s, char *addr, char c)
+{
+    int pid = fork();
+    if (pid < 0) {
+        printf("%s: fork failed\n", s);
+        exit(1);
+    }
+    if (pid == 0) {
+        *addr = c;
+        exit(0);
+    }
+    int xstatus;
+    wait(&xstatus);
+    return xstatus;
+}
+
+void mmaptest(char *s)
+{
+    // anonymous, copied on fork
+    char *p = mmap(NULL, 3 * PGSIZE, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED || p[0] != 0 || p[3 * PGSIZE - 1] != 0) {
+        printf("%s: anonymous mmap failed\n", s);
+        exit(1);
+    }
+    p[0] = 'x';
+    if (store_in_child(s, p, 'y') != 0 || p[0] != 'x') {
+        printf("%s: child store seen by parent\n", s);
+        exit(1);
+    }
+    // a hole in the middle
+    if (munmap(p + PGSIZE, PGSIZE) != 0 || p[0] != 'x' ||
+        p[2 * PGSIZE] != 0 || store_in_child(s, p + PGSIZE, 'y') != -1) {
+        printf("%s: munmap failed\n", s);
+        exit(1);
+    }
+    munmap(p, 3 * PGSIZE);
+
+    int fd = open("mmapfile", O_CREATE | O_RDWR);
+    for (int i = 0; i < PGSIZE + 100; i++) {
+        char c = 'a' + i % 26;
+        write(fd, &c, 1);
+    }
+    close(fd);
+    fd = open("mmapfile", O_RDONLY);
+
+    // private copy of the file, zeroed beyond its end
+    p = mmap(NULL, 2 * PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED || p[0] != 'a' || p[PGSIZE + 99] != 'a' + 99 % 26 ||
+        p[PGSIZE + 100] != 0) {
+        printf("%s: private file mmap failed\n", s);
+        exit(1);
+    }
+    p[0] = 'z';
+    char c;
+    if (read(fd, &c, 1) != 1 || c != 'a') {
+        printf("%s: store to private mapping reaches file\n", s);
+        exit(1);
+    }
+
+    // shared read only, same pages as another mapping
+    char *q = mmap(NULL, PGSIZE, PROT_READ, MAP_SHARED, fd, PGSIZE);
+    char *r = mmap(NULL, PGSIZE, PROT_READ, MAP_SHARED, fd, PGSIZE);
+    if (q == MAP_FAILED || r == MAP_FAILED || q[0] != 'a' + PGSIZE % 26 ||
+        memcmp(q, r, PGSIZE) != 0 || store_in_child(s, q, 'y') != -1) {
+        printf("%s: shared file mmap failed\n", s);
+        exit(1);
+    }
+    if (mmap(NULL, PGSIZE, PROT_WRITE, MAP_SHARED, fd, 0) != MAP_FAILED ||
+        mmap(NULL, PGSIZE, PROT_READ, MAP_SHARED | MAP_ANONYMOUS, -1, 0) !=
+            MAP_FAILED) {
+        printf("%s: writable shared mmap succeeded\n", s);
+        exit(1);
+    }
+    close(fd);
+    unlink("mmapfile");
+    // still mapped after the file is gone
+    if (p[0] != 'z' || q[1] != 'a' + (PGSIZE + 1) % 26) {
+        printf("%s: mapping lost with file\n", s);
+        exit(1);
+    }
+    munmap(p, 2 * PGSIZE);
+    munmap(q, PGSIZE);
+    munmap(r, PGSIZE);
+}
+
+void shmtest(char *s)
+{
+    int id = shm_create(2 * PGSIZE, SHM_PGROUP);
+    int *p = shm_attach(id);
+    if (id < 0 || p == MAP_FAILED || p[0] != 0) {
+        printf("%s: create or attach failed\n", s);
+        exit(1);
+    }
+
+    int pid = fork();
+    if (pid < 0) {
+        printf("%s: fork failed\n", s);
+        exit(1);
+    }
+    if (pid == 0) {
+        // attached twice, both are the segment
+        int *q = shm_attach(id);
+        if (q == MAP_FAILED) {
+            exit(1);
+        }
+        q[PGSIZE / sizeof(int)] = 7;
+        p[0] = 42;
+        exit(shm_detach(q) != 0);
+    }
+    int xstatus;
+    if (wait(&xstatus) != pid || xstatus != 0) {
+        printf("%s: child failed\n", s);
+        exit(1);
+    }
+    if (p[0] != 42 || p[PGSIZE / sizeof(int)] != 7) {
+        printf("%s: store of child not seen\n", s);
+        exit(1);
+    }
+
+    // attached ones live on after destroy
+    if (shm_destroy(id) != 0 || shm_attach(id) != MAP_FAILED) {
+        printf("%s: attach after destroy\n", s);
+        exit(1);
+    }
+    p[1] = 1;
+    if (shm_detach(p) != 0 || shm_detach(p) != -1) {
+        printf("%s: detach failed\n", s);
+        exit(1);
+    }
+}
+
 void forkforkfork(char *s)
 {
     unlink("stopforking");
@@ -2913,7 +3716,8 @@ void stacktest(char *s)
     pid = fork();
     if (pid == 0) {
         char *sp = (char *)r_sp();
-        sp -= PGSIZE;
+        // stack grows down to USTACK_MAX_PAGES pages, then the guard page
+        sp -= PGSIZE * USTACK_MAX_PAGES;
         // the *sp should cause a trap.
         printf("%s: stacktest: read below stack %p\n", *sp);
         exit(1);
@@ -3189,6 +3993,11 @@ struct test {
     { create_pg, "create_pg" }, 
     { enter_wrong_pg, "enter_wrong_pg" }, 
     { enter_pg, "enter_pg" }, 
+    { sched_policy, "sched_policy" },
+    { time_slice, "time_slice" },
+    { affinity, "affinity" },
+    { pg_barrier, "pg_barrier" },
+    { pg_autoscale, "pg_autoscale" },
     { execout, "execout" },
     { copyin, "copyin" },
     { copyout, "copyout" },
@@ -3206,6 +4015,17 @@ struct test {
     { reparent, "reparent" },
     { twochildren, "twochildren" },
     { forkfork, "forkfork" },
+    { manyprocs, "manyprocs" },
+    { cowfork, "cowfork" },
+    { lazymem, "lazymem" },
+    { lazyexec, "lazyexec" },
+    { textwrite, "textwrite" },
+    { mmaptest, "mmaptest" },
+    { shmtest, "shmtest" },
+    { threads, "threads" },
+    { threadsync, "threadsync" },
+    { unmapread, "unmapread" },
+    { futexcow, "futexcow" },
     { forkforkfork, "forkforkfork" }, 
     { argptest, "argptest" },
     { createdelete, "createdelete" },